@@ -25,10 +25,19 @@ enum plum_flags {
   /* palette sorting */
   PLUM_SORT_LIGHT_FIRST =     0,
   PLUM_SORT_DARK_FIRST  = 0x800,
+  /* JPEG scaling */
+  PLUM_JPEG_SCALE_FULL    =       0,
+  PLUM_JPEG_SCALE_HALF    =  0x8000,
+  PLUM_JPEG_SCALE_QUARTER = 0x10000,
+  PLUM_JPEG_SCALE_EIGHTH  = 0x18000,
+  PLUM_JPEG_SCALE_MASK    = 0x18000,
   /* other bit flags */
-  PLUM_ALPHA_REMOVE   =  0x100,
-  PLUM_SORT_EXISTING  = 0x1000,
-  PLUM_PALETTE_REDUCE = 0x2000
+  PLUM_ALPHA_REMOVE    =  0x100,
+  PLUM_SORT_EXISTING   = 0x1000,
+  PLUM_PALETTE_REDUCE  = 0x2000,
+  PLUM_PNG_DATA_RETAIN = 0x4000,
+  PLUM_JPEG_PREVIEW    = 0x20000,
+  PLUM_JPEG_THUMBNAIL  = 0x40000
 };
 
 enum plum_image_types {
@@ -50,6 +59,11 @@ enum plum_metadata_types {
   PLUM_METADATA_FRAME_DURATION,
   PLUM_METADATA_FRAME_DISPOSAL,
   PLUM_METADATA_FRAME_AREA,
+  PLUM_METADATA_PNG_DATA,
+  PLUM_METADATA_JPEG_QUALITY,
+  PLUM_METADATA_JPEG_SUBSAMPLING,
+  PLUM_METADATA_JPEG_RESTART_INTERVAL,
+  PLUM_METADATA_PNG_REDUCTION,
   PLUM_NUM_METADATA_TYPES
 };
 
@@ -14,6 +14,10 @@ size_t plum_color_buffer_size(size_t size, unsigned flags);
 size_t plum_pixel_buffer_size(const struct plum_image * image);
 size_t plum_palette_buffer_size(const struct plum_image * image);
 unsigned plum_rotate_image(struct plum_image * image, unsigned count, int flip);
+size_t plum_transform_JPEG(const void * restrict input, size_t input_size_mode, void * restrict output, size_t output_size_mode, unsigned count, int flip,
+                           const struct plum_rectangle * restrict crop, unsigned * restrict error);
+size_t plum_requantize_JPEG(const void * restrict input, size_t input_size_mode, void * restrict output, size_t output_size_mode, unsigned quality,
+                            unsigned * restrict error);
 void plum_convert_colors(void * restrict destination, const void * restrict source, size_t count, unsigned to, unsigned from);
 uint64_t plum_convert_color(uint64_t color, unsigned from, unsigned to);
 void plum_remove_alpha(struct plum_image * image);
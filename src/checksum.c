@@ -1,6 +1,11 @@
 #include "proto.h"
 
 uint32_t compute_PNG_CRC (const unsigned char * data, size_t size) {
+  return update_PNG_CRC(0, data, size);
+}
+
+uint32_t update_PNG_CRC (uint32_t checksum, const unsigned char * data, size_t size) {
+  // continues a CRC computed by a previous call (or starts a new one, if checksum is zero)
   static const uint32_t table[] = {
     /* 0x00 */ 0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
     /* 0x08 */ 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
@@ -35,7 +40,7 @@ uint32_t compute_PNG_CRC (const unsigned char * data, size_t size) {
     /* 0xf0 */ 0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
     /* 0xf8 */ 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
   };
-  uint32_t checksum = 0xffffffff;
+  checksum = ~checksum;
   while (size --) checksum = (checksum >> 8) ^ table[(uint8_t) checksum ^ *(data ++)];
   return ~checksum;
 }
@@ -50,3 +55,27 @@ uint32_t compute_Adler32_checksum (const unsigned char * data, size_t size) {
   }
   return (second << 16) | first;
 }
+
+uint64_t compute_image_color_hash (struct context * context, const struct plum_image * image) {
+  // hashes the colors of all pixels (not their representation), so it is unaffected by palette changes that don't alter the image
+  uint64_t hash = ((uint64_t) image -> width << 32) | image -> height, palette[256];
+  hash ^= 0x9e3779b97f4a7c15u * image -> frames;
+  if (image -> palette) plum_convert_colors(palette, image -> palette, image -> max_palette_index + 1, PLUM_COLOR_64, image -> color_format);
+  size_t remaining = (size_t) image -> width * image -> height * image -> frames, offset = 0;
+  uint64_t * buffer = ctxmalloc(context, sizeof *buffer * 0x1000);
+  while (remaining) {
+    size_t count = (remaining > 0x1000) ? 0x1000 : remaining;
+    if (image -> palette)
+      for (size_t p = 0; p < count; p ++) buffer[p] = palette[image -> data8[offset + p]];
+    else
+      plum_convert_colors(buffer, image -> data8 + plum_color_buffer_size(offset, image -> color_format), count, PLUM_COLOR_64, image -> color_format);
+    for (size_t p = 0; p < count; p ++) {
+      hash = (hash ^ buffer[p]) * 0x100000001b3u;
+      hash ^= hash >> 29;
+    }
+    offset += count;
+    remaining -= count;
+  }
+  ctxfree(context, buffer);
+  return hash;
+}
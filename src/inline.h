@@ -81,20 +81,26 @@ static inline uint32_t shift_in_left (struct context * context, unsigned count,
   return result;
 }
 
+static inline void load_JPEG_byte (struct context * context, uint32_t * restrict dataword, uint8_t * restrict bits, const unsigned char ** data,
+                                   size_t * restrict size) {
+  // loads one byte (skipping stuffed bytes after it) into the dataword; the caller must ensure that *size is not zero
+  *dataword = (*dataword << 8) | **data;
+  *bits += 8;
+  while (**data == 0xff) {
+    ++ *data;
+    -- *size;
+    if (!*size) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  }
+  ++ *data;
+  -- *size;
+}
+
 static inline uint32_t shift_in_right_JPEG (struct context * context, unsigned count, uint32_t * restrict dataword, uint8_t * restrict bits,
                                             const unsigned char ** data, size_t * restrict size) {
   // unlike shift_in_left above, this function has to account for stuffed bytes (any number of 0xFF followed by a single 0x00)
   while (*bits < count) {
     if (!*size) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-    *dataword = (*dataword << 8) | **data;
-    *bits += 8;
-    while (**data == 0xff) {
-      ++ *data;
-      -- *size;
-      if (!*size) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-    }
-    ++ *data;
-    -- *size;
+    load_JPEG_byte(context, dataword, bits, data, size);
   }
   *bits -= count;
   uint32_t result = *dataword >> *bits;
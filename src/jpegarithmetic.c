@@ -3,12 +3,13 @@
 void decompress_JPEG_arithmetic_scan (struct context * context, struct JPEG_decompressor_state * restrict state, const struct JPEG_decoder_tables * tables,
                                       size_t rowunits, const struct JPEG_component_info * components, const size_t * restrict offsets, unsigned shift,
                                       unsigned char first, unsigned char last, bool differential) {
+  size_t colcount = 0, rowcount = 0; // position within the scan, which carries over across restart intervals
   for (size_t restart_interval = 0; restart_interval <= state -> restart_count; restart_interval ++) {
     size_t units = (restart_interval == state -> restart_count) ? state -> last_size : state -> restart_size;
     if (!units) break;
     size_t offset = *(offsets ++);
     size_t remaining = *(offsets ++);
-    size_t colcount = 0, rowcount = 0, skipunits = 0;
+    size_t skipunits = 0;
     uint16_t accumulator = 0;
     uint32_t current = 0;
     unsigned char bits = 0;
@@ -64,12 +65,19 @@ void decompress_JPEG_arithmetic_scan (struct context * context, struct JPEG_deco
           if (skipunits) skipunits --;
         }
       }
+      // units outside the component's bounds aren't coded (and thus aren't counted by restart intervals), so skipping them extends the current interval
       if (++ colcount == rowunits) {
         colcount = 0;
         rowcount ++;
-        if (rowcount == state -> row_skip_index) skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        if (rowcount == state -> row_skip_index) {
+          skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+          units += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        }
+      }
+      if (colcount == state -> column_skip_index) {
+        skipunits += state -> column_skip_count;
+        units += state -> column_skip_count;
       }
-      if (colcount == state -> column_skip_index) skipunits += state -> column_skip_count;
       for (uint_fast8_t p = 0; p < 4; p ++) if (state -> current_block[p]) {
         state -> current_block[p] += state -> unit_offset[p];
         if (!colcount) state -> current_block[p] += state -> unit_row_offset[p];
@@ -84,12 +92,13 @@ void decompress_JPEG_arithmetic_bit_scan (struct context * context, struct JPEG_
                                           unsigned char last) {
   // this function is very similar to decompress_JPEG_arithmetic_scan, but it only decodes the next bit for already-initialized data
   if (last && !first) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  size_t colcount = 0, rowcount = 0; // position within the scan, which carries over across restart intervals
   for (size_t restart_interval = 0; restart_interval <= state -> restart_count; restart_interval ++) {
     size_t units = (restart_interval == state -> restart_count) ? state -> last_size : state -> restart_size;
     if (!units) break;
     size_t offset = *(offsets ++);
     size_t remaining = *(offsets ++);
-    size_t colcount = 0, rowcount = 0, skipunits = 0;
+    size_t skipunits = 0;
     uint16_t accumulator = 0;
     uint32_t current = 0;
     unsigned char bits = 0;
@@ -132,12 +141,19 @@ void decompress_JPEG_arithmetic_bit_scan (struct context * context, struct JPEG_
             **outputunit += 1 << shift;
           outputunit ++;
       }
+      // units outside the component's bounds aren't coded (and thus aren't counted by restart intervals), so skipping them extends the current interval
       if (++ colcount == rowunits) {
         colcount = 0;
         rowcount ++;
-        if (rowcount == state -> row_skip_index) skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        if (rowcount == state -> row_skip_index) {
+          skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+          units += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        }
+      }
+      if (colcount == state -> column_skip_index) {
+        skipunits += state -> column_skip_count;
+        units += state -> column_skip_count;
       }
-      if (colcount == state -> column_skip_index) skipunits += state -> column_skip_count;
       for (uint_fast8_t p = 0; p < 4; p ++) if (state -> current_block[p]) {
         state -> current_block[p] += state -> unit_offset[p];
         if (!colcount) state -> current_block[p] += state -> unit_row_offset[p];
@@ -204,13 +220,20 @@ void decompress_JPEG_arithmetic_lossless_scan (struct context * context, struct
           }
           x ++;
       }
+      // units outside the component's bounds aren't coded (and thus aren't counted by restart intervals), so skipping them extends the current interval
       if (++ colcount == rowunits) {
         colcount = 0;
         rowcount ++;
-        if (rowcount == state -> row_skip_index) skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        if (rowcount == state -> row_skip_index) {
+          skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+          units += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        }
         memset(coldifferences, 0, sizeof coldifferences);
       }
-      if (colcount == state -> column_skip_index) skipunits += state -> column_skip_count;
+      if (colcount == state -> column_skip_index) {
+        skipunits += state -> column_skip_count;
+        units += state -> column_skip_count;
+      }
       for (uint_fast8_t p = 0; p < 4; p ++) if (state -> current_value[p]) {
         state -> current_value[p] += state -> unit_offset[p];
         if (!colcount) state -> current_value[p] += state -> unit_row_offset[p];
@@ -36,7 +36,7 @@ unsigned get_JPEG_component_count (uint32_t components) {
 }
 
 void (* get_JPEG_component_transfer_function (struct context * context, const struct JPEG_marker_layout * layout, uint32_t components))
-      (uint64_t * restrict, size_t, unsigned, const double **) {
+      (uint64_t * restrict, size_t, unsigned, const float **) {
   /* The JPEG standard has a very large deficiency: it specifies how to encode an arbitrary set of components of an
      image, but it doesn't specify what those components mean. Components have a single byte ID to identify them, but
      beyond that, the standard just hopes that applications can somehow figure it all out.
@@ -46,7 +46,7 @@ void (* get_JPEG_component_transfer_function (struct context * context, const st
      This function therefore attempts to guess what the image's components mean, and errors out if it can't. */
   if (components < 0x100)
     // if there's only one component, assume the image is just grayscale
-    return &JPEG_transfer_grayscale;
+    return &JPEG_transfer_grayscale_float;
   if (layout -> Adobe) {
     if (read_be16_unaligned(context -> data + layout -> Adobe) < 14) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     // Adobe stores a color format ID and specifies four possibilities based on it
@@ -57,208 +57,290 @@ void (* get_JPEG_component_transfer_function (struct context * context, const st
           throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
         else if (components < 0x1000000u)
           if (components == 0x524742u || components == 0x726762u) // 'R', 'G', 'B' (including lowercase)
-            return &JPEG_transfer_BGR;
+            return &JPEG_transfer_BGR_float;
           else if (!((components + 0x102) % 0x10101u)) // any sequential IDs
-            return &JPEG_transfer_RGB;
+            return &JPEG_transfer_RGB_float;
           else
             throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
         else
           if (components == 0x594d4b43u || components == 0x796d6b63u) // 'C', 'M', 'Y', 'K' (including lowercase)
-            return &JPEG_transfer_CKMY;
+            return &JPEG_transfer_CKMY_float;
           else if (!((components + 0x10203u) % 0x1010101u)) // any sequential IDs
-            return &JPEG_transfer_CMYK;
+            return &JPEG_transfer_CMYK_float;
           else
             throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
       case 1:
         // YCbCr: verify three components and detect the order
         if (components < 0x10000u || components >= 0x1000000u) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
         if (components == 0x635943u) // 'Y', 'C', 'c'
-          return &JPEG_transfer_CbYCr;
+          return &JPEG_transfer_CbYCr_float;
         else if (!((components + 0x102) % 0x10101u)) // any sequential IDs
-          return &JPEG_transfer_YCbCr;
+          return &JPEG_transfer_YCbCr_float;
         else
           throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
       case 2:
         // YCbCrK: verify four components and detect the order
         if (components < 0x1000000u) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
         if (components == 0x63594b43u) // 'Y', 'C', 'c', 'K'
-          return &JPEG_transfer_CbKYCr;
+          return &JPEG_transfer_CbKYCr_float;
         else if (!((components + 0x10203u) % 0x1010101u)) // any sequential IDs
-          return &JPEG_transfer_YCbCrK;
+          return &JPEG_transfer_YCbCrK_float;
       default:
         throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     }
   }
   if (layout -> JFIF) {
     // JFIF mandates one of two possibilities: grayscale (handled already) or YCbCr with IDs of 1, 2, 3 (although some encoders also use 0, 1, 2)
-    if (components == 0x30201u || components == 0x20100u) return &JPEG_transfer_YCbCr;
+    if (components == 0x30201u || components == 0x20100u) return &JPEG_transfer_YCbCr_float;
     throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
   }
   // below this line it's pure guesswork: there are no application headers hinting at components, so just guess from popular ID values
   if ((*layout -> frametype & 3) == 3 && components >= 0x10000u && components < 0x1000000u && !((components + 0x102) % 0x10101u))
     // lossless encoding, three sequential component IDs
-    return &JPEG_transfer_RGB;
+    return &JPEG_transfer_RGB_float;
   switch (components) {
     case 0x5941u: // 'Y', 'A'
-      return &JPEG_transfer_alpha_grayscale;
+      return &JPEG_transfer_alpha_grayscale_float;
     case 0x20100u: // 0, 1, 2: used by libjpeg sometimes
     case 0x30201u: // 1, 2, 3: JFIF's standard IDs
     case 0x232201u: // 1, 0x22, 0x23: used by some library for 'big gamut' colors
-      return &JPEG_transfer_YCbCr;
+      return &JPEG_transfer_YCbCr_float;
     case 0x635943u: // 'Y', 'C', 'c'
-      return &JPEG_transfer_CbYCr;
+      return &JPEG_transfer_CbYCr_float;
     case 0x524742u: // 'R', 'G', 'B'
     case 0x726762u: // 'r', 'g', 'b'
-      return &JPEG_transfer_BGR;
+      return &JPEG_transfer_BGR_float;
     case 0x4030201u: // 1, 2, 3, 4
-      return &JPEG_transfer_YCbCrK;
+      return &JPEG_transfer_YCbCrK_float;
     case 0x63594b43u: // 'Y', 'C', 'c', 'K'
-      return &JPEG_transfer_CbKYCr;
+      return &JPEG_transfer_CbKYCr_float;
     case 0x63594341u: // 'Y', 'C', 'c', 'A'
-      return &JPEG_transfer_ACbYCr;
+      return &JPEG_transfer_ACbYCr_float;
     case 0x52474241u: // 'R', 'G', 'B', 'A'
     case 0x72676261u: // 'r', 'g', 'b', 'a'
-      return &JPEG_transfer_ABGR;
+      return &JPEG_transfer_ABGR_float;
     case 0x594d4b43u: // 'C', 'M', 'Y', 'K'
     case 0x796d6b63u: // 'c', 'm', 'y', 'k'
-      return &JPEG_transfer_CKMY;
+      return &JPEG_transfer_CKMY_float;
     default:
       throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
   }
 }
 
-void append_JPEG_color_depth_metadata (struct context * context, void (* transfer) (uint64_t * restrict, size_t, unsigned, const double **), unsigned bitdepth) {
-  if (transfer == &JPEG_transfer_grayscale)
+void append_JPEG_color_depth_metadata (struct context * context, void (* transfer) (uint64_t * restrict, size_t, unsigned, const float **), unsigned bitdepth) {
+  if (transfer == &JPEG_transfer_grayscale_float)
     add_color_depth_metadata(context, 0, 0, 0, 0, bitdepth);
-  else if (transfer == &JPEG_transfer_alpha_grayscale)
+  else if (transfer == &JPEG_transfer_alpha_grayscale_float)
     add_color_depth_metadata(context, 0, 0, 0, bitdepth, bitdepth);
-  else if (transfer == &JPEG_transfer_ABGR || transfer == &JPEG_transfer_ACbYCr)
+  else if (transfer == &JPEG_transfer_ABGR_float || transfer == &JPEG_transfer_ACbYCr_float)
     add_color_depth_metadata(context, bitdepth, bitdepth, bitdepth, bitdepth, 0);
   else
     add_color_depth_metadata(context, bitdepth, bitdepth, bitdepth, 0, 0);
 }
 
-void JPEG_transfer_RGB (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  double factor = 65535.0 / limit;
-  const double * red = *input;
-  const double * green = input[1];
-  const double * blue = input[2];
-  while (count --) *(output ++) = color_from_floats(*(red ++) * factor, *(green ++) * factor, *(blue ++) * factor, 0);
-}
-
-void JPEG_transfer_BGR (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  JPEG_transfer_RGB(output, count, limit, (const double * []) {input[2], input[1], *input});
-}
-
-void JPEG_transfer_ABGR (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  double factor = 65535.0 / limit;
-  const double * red = input[3];
-  const double * green = input[2];
-  const double * blue = input[1];
-  const double * alpha = *input;
-  while (count --) *(output ++) = color_from_floats(*(red ++) * factor, *(green ++) * factor, *(blue ++) * factor, (limit - *(alpha ++)) * factor);
-}
-
-void JPEG_transfer_grayscale (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  double factor = 65535.0 / limit;
-  const double * luma = *input;
-  while (count --) {
-    double scaled = *(luma ++) * factor;
-    *(output ++) = color_from_floats(scaled, scaled, scaled, 0);
-  }
-}
-
-void JPEG_transfer_alpha_grayscale (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  double factor = 65535.0 / limit;
-  const double * luma = input[1];
-  const double * alpha = *input;
-  while (count --) {
-    double scaled = *(luma ++) * factor;
-    *(output ++) = color_from_floats(scaled, scaled, scaled, (limit - *(alpha ++)) * factor);
-  }
-}
-
-// all constants are defined to have exactly 53 bits of precision (matching IEEE 754 doubles)
-#define RED_COEF      0x0.b374bc6a7ef9d8p+0
-#define BLUE_COEF     0x0.e2d0e560418938p+0
-#define GREEN_CR_COEF 0x0.5b68d15d0f6588p+0
-#define GREEN_CB_COEF 0x0.2c0ca8674cd62ep+0
-
-void JPEG_transfer_YCbCr (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  double factor = 65535.0 / limit;
-  const double * luma = *input;
-  const double * blue_chroma = input[1];
-  const double * red_chroma = input[2];
-  while (count --) {
-    double blue_offset = limit - *(blue_chroma ++) * 2;
-    double red_offset = limit - *(red_chroma ++) * 2;
-    double red = *luma - RED_COEF * red_offset, blue = *luma - BLUE_COEF * blue_offset;
-    double green = *luma + GREEN_CB_COEF * blue_offset + GREEN_CR_COEF * red_offset;
-    luma ++;
-    *(output ++) = color_from_floats(red * factor, green * factor, blue * factor, 0);
-  }
-}
-
-void JPEG_transfer_CbYCr (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  JPEG_transfer_YCbCr(output, count, limit, (const double * []) {input[1], *input, input[2]});
+void (* get_JPEG_double_transfer_function (void (* transfer) (uint64_t * restrict, size_t, unsigned, const float **)))
+      (uint64_t * restrict, size_t, unsigned, const double **) {
+  // returns the double-precision counterpart of a transfer function returned by get_JPEG_component_transfer_function
+  if (transfer == &JPEG_transfer_RGB_float) return &JPEG_transfer_RGB_double;
+  if (transfer == &JPEG_transfer_BGR_float) return &JPEG_transfer_BGR_double;
+  if (transfer == &JPEG_transfer_ABGR_float) return &JPEG_transfer_ABGR_double;
+  if (transfer == &JPEG_transfer_grayscale_float) return &JPEG_transfer_grayscale_double;
+  if (transfer == &JPEG_transfer_alpha_grayscale_float) return &JPEG_transfer_alpha_grayscale_double;
+  if (transfer == &JPEG_transfer_YCbCr_float) return &JPEG_transfer_YCbCr_double;
+  if (transfer == &JPEG_transfer_CbYCr_float) return &JPEG_transfer_CbYCr_double;
+  if (transfer == &JPEG_transfer_YCbCrK_float) return &JPEG_transfer_YCbCrK_double;
+  if (transfer == &JPEG_transfer_CbKYCr_float) return &JPEG_transfer_CbKYCr_double;
+  if (transfer == &JPEG_transfer_ACbYCr_float) return &JPEG_transfer_ACbYCr_double;
+  if (transfer == &JPEG_transfer_CMYK_float) return &JPEG_transfer_CMYK_double;
+  return &JPEG_transfer_CKMY_double;
 }
 
-void JPEG_transfer_YCbCrK (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  // this function replicates the YCbCr transfer function, but then darkens each color by the K component
-  double factor = 65535.0 / ((uint32_t) limit * limit);
-  const double * luma = *input;
-  const double * blue_chroma = input[1];
-  const double * red_chroma = input[2];
-  const double * black = input[3];
-  while (count --) {
-    double blue_offset = limit - *(blue_chroma ++) * 2;
-    double red_offset = limit - *(red_chroma ++) * 2;
-    double red = *luma - RED_COEF * red_offset, blue = *luma - BLUE_COEF * blue_offset;
-    double green = *luma + GREEN_CB_COEF * blue_offset + GREEN_CR_COEF * red_offset;
-    luma ++;
-    double scale = *(black ++) * factor;
-    *(output ++) = color_from_floats(red * scale, green * scale, blue * scale, 0);
-  }
-}
+// the color conversion constants are defined with exactly as many bits of precision as each type has (24 bits for floats, 53 bits for doubles)
+#define RED_COEF_float       0x0.b374bcp+0f
+#define BLUE_COEF_float      0x0.e2d0e5p+0f
+#define GREEN_CR_COEF_float  0x0.5b68d18p+0f
+#define GREEN_CB_COEF_float  0x0.2c0ca88p+0f
+#define RED_COEF_double      0x0.b374bc6a7ef9d8p+0
+#define BLUE_COEF_double     0x0.e2d0e560418938p+0
+#define GREEN_CR_COEF_double 0x0.5b68d15d0f6588p+0
+#define GREEN_CB_COEF_double 0x0.2c0ca8674cd62ep+0
 
-void JPEG_transfer_CbKYCr (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  JPEG_transfer_YCbCrK(output, count, limit, (const double * []) {input[2], *input, input[3], input[1]});
+// transfer functions convert component data into colors; they are generated in single precision (for DCT-based images, which are decoded a row of MCUs
+// at a time) and in double precision (for lossless and hierarchical images, which can have up to 16 bits of precision)
+// the YCbCrK transfer functions replicate the YCbCr ones, but then darken each color by the K component; the ACbYCr ones compute a separate alpha channel
+#define JPEG_TRANSFER_FUNCTIONS(type)                                                                                                                    \
+void JPEG_transfer_RGB_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                        \
+  type factor = 65535.0 / limit;                                                                                                                         \
+  const type * red = *input;                                                                                                                             \
+  const type * green = input[1];                                                                                                                         \
+  const type * blue = input[2];                                                                                                                          \
+  while (count --) *(output ++) = color_from_floats(*(red ++) * factor, *(green ++) * factor, *(blue ++) * factor, 0);                                   \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_BGR_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                        \
+  JPEG_transfer_RGB_ ## type(output, count, limit, (const type * []) {input[2], input[1], *input});                                                      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_ABGR_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                       \
+  type factor = 65535.0 / limit;                                                                                                                         \
+  const type * red = input[3];                                                                                                                           \
+  const type * green = input[2];                                                                                                                         \
+  const type * blue = input[1];                                                                                                                          \
+  const type * alpha = *input;                                                                                                                           \
+  while (count --) *(output ++) = color_from_floats(*(red ++) * factor, *(green ++) * factor, *(blue ++) * factor, (limit - *(alpha ++)) * factor);      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_grayscale_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                  \
+  type factor = 65535.0 / limit;                                                                                                                         \
+  const type * luma = *input;                                                                                                                            \
+  while (count --) {                                                                                                                                     \
+    type scaled = *(luma ++) * factor;                                                                                                                   \
+    *(output ++) = color_from_floats(scaled, scaled, scaled, 0);                                                                                         \
+  }                                                                                                                                                      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_alpha_grayscale_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                            \
+  type factor = 65535.0 / limit;                                                                                                                         \
+  const type * luma = input[1];                                                                                                                          \
+  const type * alpha = *input;                                                                                                                           \
+  while (count --) {                                                                                                                                     \
+    type scaled = *(luma ++) * factor;                                                                                                                   \
+    *(output ++) = color_from_floats(scaled, scaled, scaled, (limit - *(alpha ++)) * factor);                                                            \
+  }                                                                                                                                                      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_YCbCr_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                      \
+  type factor = 65535.0 / limit;                                                                                                                         \
+  const type * luma = *input;                                                                                                                            \
+  const type * blue_chroma = input[1];                                                                                                                   \
+  const type * red_chroma = input[2];                                                                                                                    \
+  while (count --) {                                                                                                                                     \
+    type blue_offset = limit - *(blue_chroma ++) * 2;                                                                                                    \
+    type red_offset = limit - *(red_chroma ++) * 2;                                                                                                      \
+    type red = *luma - RED_COEF_ ## type * red_offset, blue = *luma - BLUE_COEF_ ## type * blue_offset;                                                  \
+    type green = *luma + GREEN_CB_COEF_ ## type * blue_offset + GREEN_CR_COEF_ ## type * red_offset;                                                     \
+    luma ++;                                                                                                                                             \
+    *(output ++) = color_from_floats(red * factor, green * factor, blue * factor, 0);                                                                    \
+  }                                                                                                                                                      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_CbYCr_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                      \
+  JPEG_transfer_YCbCr_ ## type(output, count, limit, (const type * []) {input[1], *input, input[2]});                                                    \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_YCbCrK_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                     \
+  type factor = 65535.0 / ((uint32_t) limit * limit);                                                                                                    \
+  const type * luma = *input;                                                                                                                            \
+  const type * blue_chroma = input[1];                                                                                                                   \
+  const type * red_chroma = input[2];                                                                                                                    \
+  const type * black = input[3];                                                                                                                         \
+  while (count --) {                                                                                                                                     \
+    type blue_offset = limit - *(blue_chroma ++) * 2;                                                                                                    \
+    type red_offset = limit - *(red_chroma ++) * 2;                                                                                                      \
+    type red = *luma - RED_COEF_ ## type * red_offset, blue = *luma - BLUE_COEF_ ## type * blue_offset;                                                  \
+    type green = *luma + GREEN_CB_COEF_ ## type * blue_offset + GREEN_CR_COEF_ ## type * red_offset;                                                     \
+    luma ++;                                                                                                                                             \
+    type scale = *(black ++) * factor;                                                                                                                   \
+    *(output ++) = color_from_floats(red * scale, green * scale, blue * scale, 0);                                                                       \
+  }                                                                                                                                                      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_CbKYCr_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                     \
+  JPEG_transfer_YCbCrK_ ## type(output, count, limit, (const type * []) {input[2], *input, input[3], input[1]});                                         \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_ACbYCr_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                     \
+  type factor = 65535.0 / limit;                                                                                                                         \
+  const type * luma = input[2];                                                                                                                          \
+  const type * blue_chroma = input[1];                                                                                                                   \
+  const type * red_chroma = input[3];                                                                                                                    \
+  const type * alpha = *input;                                                                                                                           \
+  while (count --) {                                                                                                                                     \
+    type blue_offset = limit - *(blue_chroma ++) * 2;                                                                                                    \
+    type red_offset = limit - *(red_chroma ++) * 2;                                                                                                      \
+    type red = *luma - RED_COEF_ ## type * red_offset, blue = *luma - BLUE_COEF_ ## type * blue_offset;                                                  \
+    type green = *luma + GREEN_CB_COEF_ ## type * blue_offset + GREEN_CR_COEF_ ## type * red_offset;                                                     \
+    luma ++;                                                                                                                                             \
+    *(output ++) = color_from_floats(red * factor, green * factor, blue * factor, (limit - *(alpha ++)) * factor);                                       \
+  }                                                                                                                                                      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_CMYK_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                       \
+  type factor = 65535.0 / ((uint32_t) limit * limit);                                                                                                    \
+  const type * cyan = *input;                                                                                                                            \
+  const type * magenta = input[1];                                                                                                                       \
+  const type * yellow = input[2];                                                                                                                        \
+  const type * black = input[3];                                                                                                                         \
+  while (count --) {                                                                                                                                     \
+    type scale = *(black ++) * factor;                                                                                                                   \
+    *(output ++) = color_from_floats(*(cyan ++) * scale, *(magenta ++) * scale, *(yellow ++) * scale, 0);                                                \
+  }                                                                                                                                                      \
+}                                                                                                                                                        \
+                                                                                                                                                         \
+void JPEG_transfer_CKMY_ ## type (uint64_t * restrict output, size_t count, unsigned limit, const type ** input) {                                       \
+  JPEG_transfer_CMYK_ ## type(output, count, limit, (const type * []) {*input, input[2], input[3], input[1]});                                           \
 }
 
-void JPEG_transfer_ACbYCr (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  // this function replicates the YCbCr transfer function and computes a separate alpha channel
-  double factor = 65535.0 / limit;
-  const double * luma = input[2];
-  const double * blue_chroma = input[1];
-  const double * red_chroma = input[3];
-  const double * alpha = *input;
-  while (count --) {
-    double blue_offset = limit - *(blue_chroma ++) * 2;
-    double red_offset = limit - *(red_chroma ++) * 2;
-    double red = *luma - RED_COEF * red_offset, blue = *luma - BLUE_COEF * blue_offset;
-    double green = *luma + GREEN_CB_COEF * blue_offset + GREEN_CR_COEF * red_offset;
-    luma ++;
-    *(output ++) = color_from_floats(red * factor, green * factor, blue * factor, (limit - *(alpha ++)) * factor);
-  }
-}
+JPEG_TRANSFER_FUNCTIONS(float)
+JPEG_TRANSFER_FUNCTIONS(double)
 
-#undef RED_COEF
-#undef BLUE_COEF
-#undef GREEN_CR_COEF
-#undef GREEN_CB_COEF
+#undef JPEG_TRANSFER_FUNCTIONS
 
-void JPEG_transfer_CMYK (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  double factor = 65535.0 / ((uint32_t) limit * limit);
-  const double * cyan = *input;
-  const double * magenta = input[1];
-  const double * yellow = input[2];
-  const double * black = input[3];
-  while (count --) {
-    double scale = *(black ++) * factor;
-    *(output ++) = color_from_floats(*(cyan ++) * scale, *(magenta ++) * scale, *(yellow ++) * scale, 0);
+void write_JPEG_YCbCr_strip (struct context * context, float * const * window, const size_t * restrict compwidth, size_t firstrow, size_t rows,
+                             unsigned char chromaH, unsigned char chromaV, float levelshift, unsigned limit, unsigned rotation, unsigned flags,
+                             float * restrict buffer, uint64_t * restrict colors) {
+  // fused upsampling and color conversion for YCbCr images whose luma component isn't subsampled and whose chroma components are both subsampled by the
+  // same factor (1 or 2) in each direction; the windows are laid out like in load_JPEG_DCT_frame_to_image, and output rows are written into the image
+  // with 2x upsampling, each output sample takes 3/4 of the nearest source sample and 1/4 of the other neighbor, like interpolate_JPEG_component does
+  // buffer must have room for two rows of the image (upsampled chroma rows) and a row of the chroma windows (vertically interpolated chroma); colors must
+  // have room for a row of the image, unless the image uses 64-bit colors and it isn't rotated
+  size_t width = context -> image -> width;
+  float factor = 65535.0f / limit;
+  float * upsampled[] = {buffer, buffer + width};
+  float * blended = buffer + 2 * width;
+  for (size_t row = 0; row < rows; row ++) {
+    const float * chroma[2];
+    for (uint_fast8_t p = 0; p < 2; p ++) {
+      const float * source = window[p + 1] + (row + 1) * compwidth[p + 1];
+      if (chromaV == 2) {
+        const float * nearest = window[p + 1] + ((row + 1) / 2 + !(row & 1)) * compwidth[p + 1];
+        const float * other = window[p + 1] + ((row + 1) / 2 + (row & 1)) * compwidth[p + 1];
+        for (size_t col = 0; col < compwidth[p + 1]; col ++) blended[col] = 0.75f * nearest[col] + 0.25f * other[col];
+        source = blended;
+      }
+      if (chromaH == 2) {
+        for (size_t col = 0; col < width; col ++)
+          upsampled[p][col] = 0.75f * source[(col >> 1) + 1] + 0.25f * source[(col >> 1) + ((col & 1) ? 2 : 0)];
+        chroma[p] = upsampled[p];
+      } else if (source == blended) {
+        memcpy(upsampled[p], source + 1, sizeof *source * width);
+        chroma[p] = upsampled[p];
+      } else
+        chroma[p] = source + 1;
+    }
+    const float * luma = window[0] + (row + 1) * compwidth[0] + 1;
+    size_t offset = (firstrow + row) * width;
+    uint64_t * output = (!rotation && (flags & PLUM_COLOR_MASK) == PLUM_COLOR_64) ? context -> image -> data64 + offset : colors;
+    for (size_t col = 0; col < width; col ++) {
+      float blue_offset = limit - (chroma[0][col] + levelshift) * 2;
+      float red_offset = limit - (chroma[1][col] + levelshift) * 2;
+      float value = luma[col] + levelshift;
+      float red = value - RED_COEF_float * red_offset, blue = value - BLUE_COEF_float * blue_offset;
+      float green = value + GREEN_CB_COEF_float * blue_offset + GREEN_CR_COEF_float * red_offset;
+      output[col] = color_from_floats(red * factor, green * factor, blue * factor, 0);
+    }
+    if (output == colors)
+      write_JPEG_pixels(context, colors, offset, width, rotation, flags);
+    else if (flags & PLUM_ALPHA_INVERT)
+      for (size_t col = 0; col < width; col ++) output[col] ^= 0xffff000000000000u;
   }
 }
 
-void JPEG_transfer_CKMY (uint64_t * restrict output, size_t count, unsigned limit, const double ** input) {
-  JPEG_transfer_CMYK(output, count, limit, (const double * []) {*input, input[2], input[3], input[1]});
-}
+#undef RED_COEF_float
+#undef BLUE_COEF_float
+#undef GREEN_CR_COEF_float
+#undef GREEN_CB_COEF_float
+#undef RED_COEF_double
+#undef BLUE_COEF_double
+#undef GREEN_CR_COEF_double
+#undef GREEN_CB_COEF_double
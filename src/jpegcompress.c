@@ -1,53 +1,86 @@
 #include "proto.h"
 
-struct JPEG_encoded_value * generate_JPEG_luminance_data_stream (struct context * context, double (* restrict data)[64], size_t units,
+struct JPEG_encoded_value * generate_JPEG_luminance_data_stream (struct context * context, double (* restrict data)[64], size_t units, size_t restart,
                                                                  const uint8_t quantization[restrict static 64], size_t * restrict count) {
+  // restart is the number of units per restart interval (or zero if there are no restart intervals); DC predictions are reset at each interval
   *count = 0;
   size_t allocated = 3 * units + 64;
   struct JPEG_encoded_value * result = ctxmalloc(context, sizeof *result * allocated);
-  double predicted = 0.0;
+  double predicted = 0.0, scales[64];
+  calculate_JPEG_DCT_scales(scales, quantization);
   for (size_t unit = 0; unit < units; unit ++) {
     if (allocated - *count < 64) {
       size_t newsize = allocated + 3 * (units - unit) + 64;
       if (newsize < allocated) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
       result = ctxrealloc(context, result, sizeof *result * (allocated = newsize));
     }
-    predicted = generate_JPEG_data_unit(result, count, data[unit], quantization, predicted);
+    if (restart && !(unit % restart)) predicted = 0.0;
+    predicted = generate_JPEG_data_unit(result, count, data[unit], scales, predicted);
   }
   return ctxrealloc(context, result, *count * sizeof *result);
 }
 
 struct JPEG_encoded_value * generate_JPEG_chrominance_data_stream (struct context * context, double (* restrict blue)[64], double (* restrict red)[64],
-                                                                   size_t units, const uint8_t quantization[restrict static 64], size_t * restrict count) {
+                                                                   size_t units, size_t restart, const uint8_t quantization[restrict static 64],
+                                                                   size_t * restrict count) {
   *count = 0;
   size_t allocated = 6 * units + 128;
   struct JPEG_encoded_value * result = ctxmalloc(context, sizeof *result * allocated);
-  double predicted_blue = 0.0, predicted_red = 0.0;
+  double predicted_blue = 0.0, predicted_red = 0.0, scales[64];
+  calculate_JPEG_DCT_scales(scales, quantization);
   for (size_t unit = 0; unit < units; unit ++) {
     if (allocated - *count < 128) {
       size_t newsize = allocated + 6 * (units - unit) + 128;
       if (newsize < allocated) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
       result = ctxrealloc(context, result, sizeof *result * (allocated = newsize));
     }
-    predicted_blue = generate_JPEG_data_unit(result, count, blue[unit], quantization, predicted_blue);
-    predicted_red = generate_JPEG_data_unit(result, count, red[unit], quantization, predicted_red);
+    if (restart && !(unit % restart)) predicted_blue = predicted_red = 0.0;
+    predicted_blue = generate_JPEG_data_unit(result, count, blue[unit], scales, predicted_blue);
+    predicted_red = generate_JPEG_data_unit(result, count, red[unit], scales, predicted_red);
+  }
+  return ctxrealloc(context, result, *count * sizeof *result);
+}
+
+struct JPEG_encoded_value * generate_JPEG_coefficient_data_stream (struct context * context, int16_t (* restrict data)[64], size_t blockrow,
+                                                                   size_t width, size_t height, size_t * restrict count) {
+  // encodes a component's blocks of already quantized coefficients (width x height blocks, with rows of blocks blockrow blocks apart) for a single scan
+  *count = 0;
+  size_t units = width * height, allocated = 3 * units + 64;
+  struct JPEG_encoded_value * result = ctxmalloc(context, sizeof *result * allocated);
+  int16_t predicted = 0;
+  for (size_t unit = 0; unit < units; unit ++) {
+    if (allocated - *count < 64) {
+      size_t newsize = allocated + 3 * (units - unit) + 64;
+      if (newsize < allocated) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
+      result = ctxrealloc(context, result, sizeof *result * (allocated = newsize));
+    }
+    int16_t block[64];
+    memcpy(block, data[unit / width * blockrow + unit % width], sizeof block);
+    *block -= predicted;
+    predicted += *block;
+    encode_JPEG_coefficients(result, count, block);
   }
   return ctxrealloc(context, result, *count * sizeof *result);
 }
 
 double generate_JPEG_data_unit (struct JPEG_encoded_value * data, size_t * restrict count, const double unit[restrict static 64],
-                                const uint8_t quantization[restrict static 64], double predicted) {
+                                const double scales[restrict static 64], double predicted) {
   int16_t output[64];
-  predicted = apply_JPEG_DCT(output, unit, quantization, predicted);
+  predicted = apply_JPEG_DCT(output, unit, scales, predicted);
+  encode_JPEG_coefficients(data, count, output);
+  return predicted;
+}
+
+void encode_JPEG_coefficients (struct JPEG_encoded_value * data, size_t * restrict count, const int16_t coefficients[restrict static 64]) {
+  // the first coefficient must already be a DC difference; writes at most 64 values
   uint_fast8_t last = 0;
-  encode_JPEG_value(data + (*count) ++, *output, 0, 0);
-  for (uint_fast8_t p = 1; p < 63; p ++) if (output[p]) {
+  encode_JPEG_value(data + (*count) ++, *coefficients, 0, 0);
+  for (uint_fast8_t p = 1; p < 64; p ++) if (coefficients[p]) {
     for (; (p - last) > 16; last += 16) data[(*count) ++] = (struct JPEG_encoded_value) {.code = 0xf0, .bits = 0, .type = 1};
-    encode_JPEG_value(data + (*count) ++, output[p], 1, (p - last - 1) << 4);
+    encode_JPEG_value(data + (*count) ++, coefficients[p], 1, (p - last - 1) << 4);
     last = p;
   }
   if (last != 63) data[(*count) ++] = (struct JPEG_encoded_value) {.code = 0, .bits = 0, .type = 1};
-  return predicted;
 }
 
 void encode_JPEG_value (struct JPEG_encoded_value * data, int16_t value, unsigned type, unsigned char addend) {
@@ -87,20 +120,34 @@ size_t generate_JPEG_Huffman_table (struct context * context, const struct JPEG_
   return outsize;
 }
 
-void encode_JPEG_scan (struct context * context, const struct JPEG_encoded_value * data, size_t count, const unsigned char table[restrict static 0x200]) {
+void encode_JPEG_scan (struct context * context, const struct JPEG_encoded_value * data, size_t count, const unsigned char table[restrict static 0x200],
+                       size_t restart) {
+  // restart is the number of units (i.e., DC values) per restart interval, or zero if there are no restart intervals
   unsigned short codes[0x200]; // no need to create a dummy entry for the highest (invalid) code here: it simply won't be generated
   generate_Huffman_codes(codes, 0x100, table, false);
   generate_Huffman_codes(codes + 0x100, 0x100, table + 0x100, false);
   unsigned char * node = append_output_node(context, 0x4000);
-  size_t size = 0;
+  size_t size = 0, units = 0;
   uint_fast32_t output = 0;
-  unsigned char bits = 0;
+  unsigned char bits = 0, marker = 0;
   for (size_t p = 0; p < count; p ++) {
-    if (size > 0x3ff8) {
+    // leave room for a restart marker (with the preceding padding) and a value: 4 + 8 bytes at most
+    if (size > 0x3ff0) {
       context -> output -> size = size;
       node = append_output_node(context, 0x4000);
       size = 0;
     }
+    if (restart && !data[p].type && units ++ == restart) {
+      // end the restart interval: pad the last byte with 1 bits (as required by the standard) and insert the next RSTn marker
+      if (bits) {
+        node[size ++] = (output << (8 - bits)) | (0xff >> bits);
+        if (node[size - 1] == 0xff) node[size ++] = 0;
+        bits = 0;
+      }
+      size += byteappend(node + size, 0xff, 0xd0 + marker);
+      marker = (marker + 1) & 7;
+      units = 1;
+    }
     unsigned short index = data[p].type * 0x100 + data[p].code;
     output = (output << table[index]) | codes[index];
     bits += table[index];
@@ -13,23 +13,17 @@
 // half the square root of 2
 #define HR2 0x0.b504f333f9de68p+0
 
-double apply_JPEG_DCT (int16_t output[restrict static 64], const double input[restrict static 64], const uint8_t quantization[restrict static 64], double prevDC) {
-  // coefficient(dst, src) = cos((2 * src + 1) * dst * pi / 16) / 2; this absorbs a leading factor of 1/4 (square rooted)
-  static const double coefficients[8][8] = {
-    {0.5,  C1,  C2,  C3,  C4,  C5,  C6,  C7},
-    {0.5,  C3,  C6, -C7, -C4, -C1, -C2, -C5},
-    {0.5,  C5, -C6, -C1, -C4,  C7,  C2,  C3},
-    {0.5,  C7, -C2, -C5,  C4,  C3, -C6, -C1},
-    {0.5, -C7, -C2,  C5,  C4, -C3, -C6,  C1},
-    {0.5, -C5, -C6,  C1, -C4, -C7,  C2, -C3},
-    {0.5, -C3,  C6,  C7, -C4,  C1, -C2,  C5},
-    {0.5, -C1,  C2, -C3,  C4, -C5,  C6, -C7}
-  };
-  // factor(row, col) = (row ? 1 : 1 / sqrt(2)) * (col ? 1 : 1 / sqrt(2)); converted into zigzag order
-  static const double factors[] = {
-    0.5, HR2, HR2, HR2, 1.0, HR2, HR2, 1.0, 1.0, HR2, HR2, 1.0, 1.0, 1.0, HR2, HR2, 1.0, 1.0, 1.0, 1.0, HR2, HR2, 1.0, 1.0, 1.0, 1.0, 1.0, HR2, HR2, 1.0, 1.0, 1.0,
-    1.0, 1.0, 1.0, HR2, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0
-  };
+void calculate_JPEG_DCT_scales (double scales[restrict static 64], const uint8_t quantization[restrict static 64]) {
+  // the forward DCT (apply_JPEG_DCT_line) generates coefficients scaled by 8 * factor(row) * factor(col), where factor(0) = 1 and
+  // factor(k) = sqrt(2) * cos(k * pi / 16) = 4 * HR2 * Ck; this scaling is undone together with the quantization by multiplying by these scales
+  // (converted into zigzag order), so that apply_JPEG_DCT needs no divisions at all
+  static const double factors[] = {1.0, 4 * HR2 * C1, 4 * HR2 * C2, 4 * HR2 * C3, 1.0, 4 * HR2 * C5, 4 * HR2 * C6, 4 * HR2 * C7};
+  for (uint_fast8_t index = 0; index < 64; index ++)
+    scales[index] = 1.0 / (8.0 * factors[JPEG_zigzag_rows[index]] * factors[JPEG_zigzag_columns[index]] * quantization[index]);
+}
+
+double apply_JPEG_DCT (int16_t output[restrict static 64], const double input[restrict static 64], const double scales[restrict static 64], double prevDC) {
+  // the 2D DCT is separable: apply a 1D DCT to each row of the input, and then to each column of the result; scales comes from calculate_JPEG_DCT_scales
   // zero-flushing threshold: for later coefficients, round some values slightly larger than 0.5 to 0 instead of +/- 1 for better compression
   static const double zeroflush[] = {
     0x0.80p+0, 0x0.80p+0, 0x0.80p+0, 0x0.80p+0, 0x0.81p+0, 0x0.80p+0, 0x0.84p+0, 0x0.85p+0, 0x0.85p+0, 0x0.84p+0,
@@ -40,12 +34,11 @@ double apply_JPEG_DCT (int16_t output[restrict static 64], const double input[re
     0x0.a1p+0, 0x0.a2p+0, 0x0.a1p+0, 0x0.a0p+0, 0x0.a4p+0, 0x0.a5p+0, 0x0.a5p+0, 0x0.a4p+0, 0x0.a8p+0, 0x0.a9p+0,
     0x0.a8p+0, 0x0.acp+0, 0x0.acp+0, 0x0.b0p+0
   };
+  double transformed[64], coefficients[64];
+  for (uint_fast8_t row = 0; row < 8; row ++) apply_JPEG_DCT_line(transformed + row * 8, input + row * 8, 1);
+  for (uint_fast8_t col = 0; col < 8; col ++) apply_JPEG_DCT_line(coefficients + col, transformed + col, 8);
   for (uint_fast8_t index = 0; index < 64; index ++) {
-    uint_fast8_t p = 0;
-    double converted = 0.0;
-    for (uint_fast8_t row = 0; row < 8; row ++) for (uint_fast8_t col = 0; col < 8; col ++)
-      converted += input[p ++] * coefficients[col][JPEG_zigzag_columns[index]] * coefficients[row][JPEG_zigzag_rows[index]];
-    converted = converted * factors[index] / quantization[index];
+    double converted = coefficients[JPEG_zigzag_rows[index] * 8 + JPEG_zigzag_columns[index]] * scales[index];
     if (index)
       if (converted >= -zeroflush[index] && converted <= zeroflush[index])
         output[index] = 0;
@@ -72,26 +65,115 @@ double apply_JPEG_DCT (int16_t output[restrict static 64], const double input[re
   return prevDC + *output;
 }
 
-void apply_JPEG_inverse_DCT (double output[restrict static 64], const int16_t input[restrict static 64], const uint16_t quantization[restrict static 64]) {
-  // coefficient(dst, src) = 0.5 * (src ? cos((2 * dst + 1) * src * pi / 16) : 1 / sqrt(2)); this absorbs a leading factor of 1/4 (square rooted)
-  static const double coefficients[8][8] = {
-    {C4,  C1,  C2,  C3,  C4,  C5,  C6,  C7},
-    {C4,  C3,  C6, -C7, -C4, -C1, -C2, -C5},
-    {C4,  C5, -C6, -C1, -C4,  C7,  C2,  C3},
-    {C4,  C7, -C2, -C5,  C4,  C3, -C6, -C1},
-    {C4, -C7, -C2,  C5,  C4, -C3, -C6,  C1},
-    {C4, -C5, -C6,  C1, -C4, -C7,  C2, -C3},
-    {C4, -C3,  C6,  C7, -C4,  C1, -C2,  C5},
-    {C4, -C1,  C2, -C3,  C4, -C5,  C6, -C7}
-  };
-  double dequantized[64];
-  for (uint_fast8_t index = 0; index < 64; index ++) dequantized[index] = (double) input[index] * quantization[index];
-  uint_fast8_t p = 0;
-  for (uint_fast8_t row = 0; row < 8; row ++) for (uint_fast8_t col = 0; col < 8; col ++) {
-    output[p] = 0;
-    for (uint_fast8_t index = 0; index < 64; index ++)
-      output[p] += coefficients[col][JPEG_zigzag_columns[index]] * coefficients[row][JPEG_zigzag_rows[index]] * dequantized[index];
-    p ++;
+void apply_JPEG_DCT_line (double * restrict output, const double * restrict input, uint_fast8_t stride) {
+  // scaled 1D DCT (Arai, Agui and Nakajima's algorithm, using only 5 multiplications): each output is the corresponding DCT coefficient multiplied by
+  // 2 * sqrt(2) * factor(k) (with factor(k) as defined by calculate_JPEG_DCT_scales); both passes together scale the 2D DCT by 8 * factor(row) * factor(col)
+  double sum0 = *input + input[7 * stride], sum1 = input[stride] + input[6 * stride], sum2 = input[2 * stride] + input[5 * stride];
+  double sum3 = input[3 * stride] + input[4 * stride], diff0 = *input - input[7 * stride], diff1 = input[stride] - input[6 * stride];
+  double diff2 = input[2 * stride] - input[5 * stride], diff3 = input[3 * stride] - input[4 * stride];
+  // even part: the outputs for even frequencies only depend on the sums
+  double even0 = sum0 + sum3, even1 = sum1 + sum2, even2 = sum1 - sum2, even3 = sum0 - sum3;
+  *output = even0 + even1;
+  output[4 * stride] = even0 - even1;
+  double rotated = (even2 + even3) * HR2;
+  output[2 * stride] = even3 + rotated;
+  output[6 * stride] = even3 - rotated;
+  // odd part: the outputs for odd frequencies only depend on the differences
+  double odd0 = diff3 + diff2, odd1 = diff2 + diff1, odd2 = diff1 + diff0;
+  double common = (odd0 - odd2) * (2 * C6), z2 = (4 * HR2 * C6) * odd0 + common, z4 = (4 * HR2 * C2) * odd2 + common, z3 = odd1 * HR2;
+  double z11 = diff0 + z3, z13 = diff0 - z3;
+  output[stride] = z11 + z4;
+  output[3 * stride] = z13 - z2;
+  output[5 * stride] = z13 + z2;
+  output[7 * stride] = z11 - z4;
+}
+
+void apply_JPEG_inverse_DCT (double output[restrict static 64], const int16_t input[restrict static 64], const uint16_t quantization[restrict static 64],
+                              uint_fast8_t last) {
+  // the 2D IDCT is separable: apply a 1D IDCT to each row of the dequantized coefficients, and then to each column of the result
+  // last is the zigzag index of the last non-zero coefficient; if all non-zero coefficients are within the top left 2x2 or 4x4 corner, only those rows
+  // and columns have to be transformed in the first pass, and the second pass can skip the remaining (zero) inputs
+  uint_fast8_t size = (last <= 2) ? 2 : (last <= 9) ? 4 : 8;
+  double coefficients[64] = {0}, transformed[64];
+  for (uint_fast8_t index = 0; index <= last; index ++)
+    coefficients[JPEG_zigzag_rows[index] * 8 + JPEG_zigzag_columns[index]] = (double) input[index] * quantization[index];
+  for (uint_fast8_t row = 0; row < size; row ++) apply_JPEG_inverse_DCT_line(transformed + row * 8, coefficients + row * 8, 1, size);
+  for (uint_fast8_t col = 0; col < 8; col ++) apply_JPEG_inverse_DCT_line(output + col, transformed + col, 8, size);
+}
+
+void apply_JPEG_inverse_DCT_line (double * restrict output, const double * restrict input, uint_fast8_t stride, uint_fast8_t size) {
+  // output[n] = C4 * input[0] + sum(0.5 * cos((2 * n + 1) * k * pi / 16) * input[k]); computed by splitting the even and odd coefficients, since
+  // output[n] and output[7 - n] use the same terms, with the odd coefficients' terms negated for the latter
+  // only the first size inputs (2, 4 or 8) can be non-zero, so terms for the remaining inputs are skipped
+  double even[4], odd[4];
+  if (size == 2) {
+    even[0] = even[1] = even[2] = even[3] = C4 * *input;
+    odd[0] = C1 * input[stride];
+    odd[1] = C3 * input[stride];
+    odd[2] = C5 * input[stride];
+    odd[3] = C7 * input[stride];
+  } else if (size == 4) {
+    double even0 = C4 * *input, even2 = C2 * input[2 * stride], even3 = C6 * input[2 * stride];
+    even[0] = even0 + even2;
+    even[1] = even0 + even3;
+    even[2] = even0 - even3;
+    even[3] = even0 - even2;
+    odd[0] = C1 * input[stride] + C3 * input[3 * stride];
+    odd[1] = C3 * input[stride] - C7 * input[3 * stride];
+    odd[2] = C5 * input[stride] - C1 * input[3 * stride];
+    odd[3] = C7 * input[stride] - C5 * input[3 * stride];
+  } else {
+    double even0 = C4 * (*input + input[4 * stride]), even1 = C4 * (*input - input[4 * stride]);
+    double even2 = C2 * input[2 * stride] + C6 * input[6 * stride], even3 = C6 * input[2 * stride] - C2 * input[6 * stride];
+    even[0] = even0 + even2;
+    even[1] = even1 + even3;
+    even[2] = even1 - even3;
+    even[3] = even0 - even2;
+    odd[0] = C1 * input[stride] + C3 * input[3 * stride] + C5 * input[5 * stride] + C7 * input[7 * stride];
+    odd[1] = C3 * input[stride] - C7 * input[3 * stride] - C1 * input[5 * stride] - C5 * input[7 * stride];
+    odd[2] = C5 * input[stride] - C1 * input[3 * stride] + C7 * input[5 * stride] + C3 * input[7 * stride];
+    odd[3] = C7 * input[stride] - C5 * input[3 * stride] + C3 * input[5 * stride] - C1 * input[7 * stride];
+  }
+  for (uint_fast8_t p = 0; p < 4; p ++) {
+    output[p * stride] = even[p] + odd[p];
+    output[(7 - p) * stride] = even[p] - odd[p];
+  }
+}
+
+void apply_JPEG_reduced_inverse_DCT (double output[restrict static 16], const int16_t input[restrict static 64],
+                                      const uint16_t quantization[restrict static 64], uint_fast8_t last, uint_fast8_t size) {
+  // reduced-size IDCT, generating a size x size block (1, 2 or 4) containing the averages of the corresponding pixels in the full 8x8 block
+  // averaging is separable as well, so the rows (all eight of them, since every coefficient contributes to the averages) are reduced first, followed by
+  // the columns of the result; the output uses the same scale factors as the full IDCT (i.e., C4 for the DC term)
+  if (size == 1) {
+    *output = (double) *input * *quantization / 8;
+    return;
+  }
+  double coefficients[64] = {0}, transformed[32];
+  for (uint_fast8_t index = 0; index <= last; index ++)
+    coefficients[JPEG_zigzag_rows[index] * 8 + JPEG_zigzag_columns[index]] = (double) input[index] * quantization[index];
+  for (uint_fast8_t row = 0; row < 8; row ++) apply_JPEG_reduced_inverse_DCT_line(transformed + row * size, coefficients + row * 8, 1, size);
+  for (uint_fast8_t col = 0; col < size; col ++) apply_JPEG_reduced_inverse_DCT_line(output + col, transformed + col, size, size);
+}
+
+void apply_JPEG_reduced_inverse_DCT_line (double * restrict output, const double * restrict input, uint_fast8_t stride, uint_fast8_t size) {
+  // computes the averages of groups of 8 / size consecutive outputs of apply_JPEG_inverse_DCT_line from all eight inputs; averaging the cosines of each
+  // group turns the sum into a size-point IDCT, where the higher inputs alias onto the lower ones (with their signs inverted) and each input k is also
+  // weighted by the average of the cosines across the group, i.e., cos(k * pi / 16) for pairs and (cos(k * pi / 16) + cos(3 * k * pi / 16)) / 2 for
+  // groups of four (this weight is 0 for input 4 in both cases)
+  if (size == 2) {
+    double odd = C4 * ((C1 + C3) * input[stride] - (C3 - C7) * input[3 * stride] + (C1 - C5) * input[5 * stride] + (C7 - C5) * input[7 * stride]);
+    output[0] = C4 * *input + odd;
+    output[stride] = C4 * *input - odd;
+  } else {
+    double in1 = 2 * (C1 * input[stride] - C7 * input[7 * stride]), in2 = 2 * (C2 * input[2 * stride] - C6 * input[6 * stride]);
+    double in3 = 2 * (C3 * input[3 * stride] - C5 * input[5 * stride]);
+    double even0 = C4 * *input + C4 * in2, even1 = C4 * *input - C4 * in2;
+    double odd0 = C2 * in1 + C6 * in3, odd1 = C6 * in1 - C2 * in3;
+    output[0] = even0 + odd0;
+    output[stride] = even1 + odd1;
+    output[2 * stride] = even1 - odd1;
+    output[3 * stride] = even0 - odd0;
   }
 }
 
@@ -52,7 +52,8 @@ void initialize_JPEG_decompressor_state_common (struct context * context, struct
     state -> row_skip_index = 1 + (height * components[*componentIDs].scaleV - 1) / (unit_dimensions * maxV);
     state -> row_skip_count = unitsV - state -> row_skip_index;
   }
-  state -> last_size = *unitsH * unitsV;
+  // restart intervals only count units that are actually coded, which excludes the units outside the component's bounds in non-interleaved scans
+  state -> last_size = (*unitsH - state -> column_skip_count) * (unitsV - state -> row_skip_count);
   if (state -> restart_size = tables -> restart) {
     state -> restart_count = state -> last_size / state -> restart_size;
     state -> last_size %= state -> restart_size;
@@ -3,10 +3,30 @@
 void decompress_JPEG_Huffman_scan (struct context * context, struct JPEG_decompressor_state * restrict state, const struct JPEG_decoder_tables * tables,
                                    size_t rowunits, const struct JPEG_component_info * components, const size_t * restrict offsets, unsigned shift,
                                    unsigned char first, unsigned char last, bool differential) {
+  short lookup[8][0x100];
+  generate_JPEG_Huffman_lookup_tables(tables, lookup);
+  // flatten the MCU description into a list of units (each one given by its component and its offset from that component's current block), so that
+  // every MCU is decoded by a plain loop over its units instead of interpreting the control codes in state -> MCU
+  unsigned char unitcomponents[64], scancomponents[4];
+  size_t unitoffsets[64], offset = 0;
+  uint_fast8_t unitcount = 0, scancount = 0;
+  for (const unsigned char * decodepos = state -> MCU; *decodepos != MCU_END_LIST; decodepos ++) switch (*decodepos) {
+    case MCU_ZERO_COORD:
+      scancomponents[scancount ++] = decodepos[1];
+      offset = 0;
+      break;
+    case MCU_NEXT_ROW:
+      offset += state -> row_offset[decodepos[1]];
+      break;
+    default:
+      unitcomponents[unitcount] = *decodepos;
+      unitoffsets[unitcount ++] = offset ++;
+  }
+  size_t colcount = 0, rowcount = 0; // position within the scan, which carries over across restart intervals
   for (size_t restart_interval = 0; restart_interval <= state -> restart_count; restart_interval ++) {
     size_t units = (restart_interval == state -> restart_count) ? state -> last_size : state -> restart_size;
     if (!units) break;
-    size_t colcount = 0, rowcount = 0, skipcount = 0, skipunits = 0;
+    size_t skipcount = 0, skipunits = 0;
     const unsigned char * data = context -> data + *(offsets ++);
     size_t count = *(offsets ++);
     uint16_t prevDC[4] = {0};
@@ -14,61 +34,64 @@ void decompress_JPEG_Huffman_scan (struct context * context, struct JPEG_decompr
     uint32_t dataword = 0;
     uint8_t bits = 0;
     while (units --) {
-      int16_t (* outputunit)[64];
-      for (const unsigned char * decodepos = state -> MCU; *decodepos != MCU_END_LIST; decodepos ++) switch (*decodepos) {
-        case MCU_ZERO_COORD:
-          outputunit = state -> current_block[decodepos[1]];
-          break;
-        case MCU_NEXT_ROW:
-          outputunit += state -> row_offset[decodepos[1]];
-          break;
-        default:
-          for (uint_fast8_t p = first; p <= last; p ++) {
-            if (!(skipcount || nextvalue || skipunits)) {
-              unsigned char decompressed;
-              if (p) {
-                decompressed = next_JPEG_Huffman_value(context, &data, &count, &dataword, &bits, tables -> Huffman[components[*decodepos].tableAC + 4]);
-                if (decompressed & 15)
-                  skipcount = decompressed >> 4;
-                else if (decompressed == 0xf0)
-                  skipcount = 16;
-                else
-                  skipunits = (1u << (decompressed >> 4)) + shift_in_right_JPEG(context, decompressed >> 4, &dataword, &bits, &data, &count);
-                decompressed &= 15;
-              } else {
-                decompressed = next_JPEG_Huffman_value(context, &data, &count, &dataword, &bits, tables -> Huffman[components[*decodepos].tableDC]);
-                if (decompressed > 15) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-              }
-              if (decompressed) {
-                uint_fast16_t extrabits = shift_in_right_JPEG(context, decompressed, &dataword, &bits, &data, &count);
-                if (!(extrabits >> (decompressed - 1))) nextvalue = make_signed_16(1u - (1u << decompressed));
-                nextvalue = make_signed_16(nextvalue + extrabits);
-              }
-            }
-            if (skipcount || skipunits) {
-              p[*outputunit] = 0;
-              if (skipcount) skipcount --;
+      for (uint_fast8_t unit = 0; unit < unitcount; unit ++) {
+        const struct JPEG_component_info * component = components + unitcomponents[unit];
+        int16_t (* outputunit)[64] = state -> current_block[unitcomponents[unit]] + unitoffsets[unit];
+        for (uint_fast8_t p = first; p <= last; p ++) {
+          if (!(skipcount || nextvalue || skipunits)) {
+            unsigned char decompressed;
+            if (p) {
+              decompressed = next_JPEG_Huffman_value(context, &data, &count, &dataword, &bits, tables -> Huffman[component -> tableAC + 4],
+                                                     lookup[component -> tableAC + 4]);
+              if (decompressed & 15)
+                skipcount = decompressed >> 4;
+              else if (decompressed == 0xf0)
+                skipcount = 16;
+              else
+                skipunits = (1u << (decompressed >> 4)) + shift_in_right_JPEG(context, decompressed >> 4, &dataword, &bits, &data, &count);
+              decompressed &= 15;
             } else {
-              p[*outputunit] = nextvalue * (1 << shift);
-              nextvalue = 0;
+              decompressed = next_JPEG_Huffman_value(context, &data, &count, &dataword, &bits, tables -> Huffman[component -> tableDC],
+                                                     lookup[component -> tableDC]);
+              if (decompressed > 15) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+            }
+            if (decompressed) {
+              uint_fast16_t extrabits = shift_in_right_JPEG(context, decompressed, &dataword, &bits, &data, &count);
+              if (!(extrabits >> (decompressed - 1))) nextvalue = make_signed_16(1u - (1u << decompressed));
+              nextvalue = make_signed_16(nextvalue + extrabits);
             }
-            if (!(p || differential)) prevDC[*decodepos] = **outputunit = make_signed_16(prevDC[*decodepos] + (uint16_t) **outputunit);
           }
-          outputunit ++;
-          if (skipunits) skipunits --;
+          if (skipcount || skipunits) {
+            p[*outputunit] = 0;
+            if (skipcount) skipcount --;
+          } else {
+            p[*outputunit] = nextvalue * (1 << shift);
+            nextvalue = 0;
+          }
+          if (!(p || differential))
+            prevDC[unitcomponents[unit]] = **outputunit = make_signed_16(prevDC[unitcomponents[unit]] + (uint16_t) **outputunit);
+        }
+        if (skipunits) skipunits --;
       }
+      // units outside the component's bounds aren't coded (and thus aren't counted by restart intervals), so skipping them extends the current interval
       if (++ colcount == rowunits) {
         colcount = 0;
         rowcount ++;
-        if (rowcount == state -> row_skip_index) skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        if (rowcount == state -> row_skip_index) {
+          skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+          units += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        }
       }
-      if (colcount == state -> column_skip_index) skipunits += state -> column_skip_count;
-      for (uint_fast8_t p = 0; p < 4; p ++) if (state -> current_block[p]) {
-        state -> current_block[p] += state -> unit_offset[p];
-        if (!colcount) state -> current_block[p] += state -> unit_row_offset[p];
+      if (colcount == state -> column_skip_index) {
+        skipunits += state -> column_skip_count;
+        units += state -> column_skip_count;
+      }
+      for (uint_fast8_t p = 0; p < scancount; p ++) {
+        state -> current_block[scancomponents[p]] += state -> unit_offset[scancomponents[p]];
+        if (!colcount) state -> current_block[scancomponents[p]] += state -> unit_row_offset[scancomponents[p]];
       }
     }
-    if (count || skipcount || skipunits || nextvalue) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    if (count || bits >= 8 || skipcount || skipunits || nextvalue) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
   }
 }
 
@@ -77,10 +100,13 @@ void decompress_JPEG_Huffman_bit_scan (struct context * context, struct JPEG_dec
                                        unsigned char first, unsigned char last) {
   // this function is essentially the same as decompress_JPEG_Huffman_scan, but it uses already-initialized component data, and it decodes one bit at a time
   if (last && !first) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  short lookup[8][0x100];
+  generate_JPEG_Huffman_lookup_tables(tables, lookup);
+  size_t colcount = 0, rowcount = 0; // position within the scan, which carries over across restart intervals
   for (size_t restart_interval = 0; restart_interval <= state -> restart_count; restart_interval ++) {
     size_t units = (restart_interval == state -> restart_count) ? state -> last_size : state -> restart_size;
     if (!units) break;
-    size_t colcount = 0, rowcount = 0, skipcount = 0, skipunits = 0;
+    size_t skipcount = 0, skipunits = 0;
     const unsigned char * data = context -> data + *(offsets ++);
     size_t count = *(offsets ++);
     int16_t nextvalue = 0;
@@ -100,7 +126,8 @@ void decompress_JPEG_Huffman_bit_scan (struct context * context, struct JPEG_dec
             for (uint_fast8_t p = first; p <= last; p ++) {
               if (!(skipcount || nextvalue || skipunits)) {
                 unsigned char decompressed = next_JPEG_Huffman_value(context, &data, &count, &dataword, &bits,
-                                                                     tables -> Huffman[components[*decodepos].tableAC + 4]);
+                                                                     tables -> Huffman[components[*decodepos].tableAC + 4],
+                                                                     lookup[components[*decodepos].tableAC + 4]);
                 if (decompressed & 15)
                   skipcount = decompressed >> 4;
                 else if (decompressed == 0xf0)
@@ -132,24 +159,33 @@ void decompress_JPEG_Huffman_bit_scan (struct context * context, struct JPEG_dec
           outputunit ++;
           if (skipunits) skipunits --;
       }
+      // units outside the component's bounds aren't coded (and thus aren't counted by restart intervals), so skipping them extends the current interval
       if (++ colcount == rowunits) {
         colcount = 0;
         rowcount ++;
-        if (rowcount == state -> row_skip_index) skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        if (rowcount == state -> row_skip_index) {
+          skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+          units += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        }
+      }
+      if (colcount == state -> column_skip_index) {
+        skipunits += state -> column_skip_count;
+        units += state -> column_skip_count;
       }
-      if (colcount == state -> column_skip_index) skipunits += state -> column_skip_count;
       for (uint_fast8_t p = 0; p < 4; p ++) if (state -> current_block[p]) {
         state -> current_block[p] += state -> unit_offset[p];
         if (!colcount) state -> current_block[p] += state -> unit_row_offset[p];
       }
     }
-    if (count || skipcount || skipunits || nextvalue) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    if (count || bits >= 8 || skipcount || skipunits || nextvalue) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
   }
 }
 
 void decompress_JPEG_Huffman_lossless_scan (struct context * context, struct JPEG_decompressor_state * restrict state, const struct JPEG_decoder_tables * tables,
                                             size_t rowunits, const struct JPEG_component_info * components, const size_t * restrict offsets,
                                             unsigned char predictor, unsigned precision) {
+  short lookup[8][0x100];
+  generate_JPEG_Huffman_lookup_tables(tables, lookup);
   for (size_t restart_interval = 0; restart_interval <= state -> restart_count; restart_interval ++) {
     size_t units = (restart_interval == state -> restart_count) ? state -> last_size : state -> restart_size;
     if (!units) break;
@@ -178,7 +214,8 @@ void decompress_JPEG_Huffman_lossless_scan (struct context * context, struct JPE
           } else {
             size_t rowsize = rowunits * ((state -> component_count > 1) ? components[*decodepos].scaleH : 1);
             uint16_t difference, predicted = predict_JPEG_lossless_sample(outputpos, rowsize, leftmost && !colcount, topmost && !rowcount, predictor, precision);
-            unsigned char diffsize = next_JPEG_Huffman_value(context, &data, &count, &dataword, &bits, tables -> Huffman[components[*decodepos].tableDC]);
+            unsigned char diffsize = next_JPEG_Huffman_value(context, &data, &count, &dataword, &bits, tables -> Huffman[components[*decodepos].tableDC],
+                                                             lookup[components[*decodepos].tableDC]);
             if (diffsize > 16) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
             switch (diffsize) {
               case 0:
@@ -195,24 +232,62 @@ void decompress_JPEG_Huffman_lossless_scan (struct context * context, struct JPE
           }
           leftmost = false;
       }
+      // units outside the component's bounds aren't coded (and thus aren't counted by restart intervals), so skipping them extends the current interval
       if (++ colcount == rowunits) {
         colcount = 0;
         rowcount ++;
-        if (rowcount == state -> row_skip_index) skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        if (rowcount == state -> row_skip_index) {
+          skipunits += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+          units += (rowunits - state -> column_skip_count) * state -> row_skip_count;
+        }
+      }
+      if (colcount == state -> column_skip_index) {
+        skipunits += state -> column_skip_count;
+        units += state -> column_skip_count;
       }
-      if (colcount == state -> column_skip_index) skipunits += state -> column_skip_count;
       for (uint_fast8_t p = 0; p < 4; p ++) if (state -> current_value[p]) {
         state -> current_value[p] += state -> unit_offset[p];
         if (!colcount) state -> current_value[p] += state -> unit_row_offset[p];
       }
     }
-    if (count || skipunits) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    if (count || bits >= 8 || skipunits) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
   }
 }
 
+void generate_JPEG_Huffman_lookup_tables (const struct JPEG_decoder_tables * tables, short lookup[restrict static 8][0x100]) {
+  // for each 8-bit prefix, the lookup table contains the decoded value and the code length in bits 8-11 if the code is at most 8 bits long; otherwise,
+  // it contains the (negated) index of the tree node reached after those 8 bits, so decoding can continue from there, or -1 if the code is invalid
+  for (uint_fast8_t table = 0; table < 8; table ++) if (tables -> Huffman[table])
+    for (uint_fast16_t prefix = 0; prefix < 0x100; prefix ++) {
+      uint_fast16_t index = 0;
+      short entry;
+      for (uint_fast8_t bit = 0; bit < 8; bit ++) {
+        entry = tables -> Huffman[table][index + ((prefix >> (7 - bit)) & 1)];
+        if (entry >= 0) {
+          entry |= (bit + 1) << 8;
+          break;
+        }
+        index = -entry;
+        if (index == 1) break;
+      }
+      lookup[table][prefix] = entry;
+    }
+}
+
 unsigned char next_JPEG_Huffman_value (struct context * context, const unsigned char ** data, size_t * restrict count, uint32_t * restrict dataword,
-                                       uint8_t * restrict bits, const short * restrict tree) {
-  for (uint_fast16_t index = 0; index != 1; index = -tree[index]) {
+                                       uint8_t * restrict bits, const short * restrict tree, const short * restrict lookup) {
+  // try to resolve the first 8 bits with the lookup table; this requires those bits to be available, which might not be the case at the end of the data
+  while (*bits < 8 && *count) load_JPEG_byte(context, dataword, bits, data, count);
+  uint_fast16_t index = 0;
+  if (*bits >= 8) {
+    short entry = lookup[(*dataword >> (*bits - 8)) & 0xff];
+    if (entry == -1) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    *bits -= (entry >= 0) ? entry >> 8 : 8;
+    *dataword &= ((uint32_t) 1 << *bits) - 1;
+    if (entry >= 0) return entry;
+    index = -entry;
+  }
+  for (; index != 1; index = -tree[index]) {
     index += shift_in_right_JPEG(context, 1, dataword, bits, data, count);
     if (tree[index] >= 0) return tree[index];
   }
@@ -1,9 +1,20 @@
 #include "proto.h"
 
 void load_JPEG_data (struct context * context, unsigned flags, size_t limit) {
-  struct JPEG_marker_layout * layout = load_JPEG_marker_layout(context); // will be leaked (to be collected by context release)
+  unsigned rotation = 0;
+  if (flags & PLUM_JPEG_THUMBNAIL) {
+    // the Exif thumbnail is a complete JPEG file embedded in the Exif data, so it is loaded in place of the main image (which is never laid out); the
+    // main image's rotation applies to it as well, since thumbnails don't usually contain their own Exif data
+    size_t Exif = find_JPEG_Exif_marker(context), size;
+    size_t thumbnail = Exif ? get_JPEG_thumbnail(context, Exif, &size) : 0;
+    if (!thumbnail) throw(context, PLUM_ERR_NO_DATA);
+    rotation = get_JPEG_rotation(context, Exif);
+    context -> data += thumbnail;
+    context -> size = size;
+  }
+  struct JPEG_marker_layout * layout = load_JPEG_marker_layout(context, flags & PLUM_JPEG_PREVIEW); // will be leaked (to be collected by context release)
   uint32_t components = determine_JPEG_components(context, layout -> hierarchical ? layout -> hierarchical : *layout -> frames);
-  void (* transfer) (uint64_t * restrict, size_t, unsigned, const double **) = get_JPEG_component_transfer_function(context, layout, components);
+  void (* transfer) (uint64_t * restrict, size_t, unsigned, const float **) = get_JPEG_component_transfer_function(context, layout, components);
   context -> image -> type = PLUM_IMAGE_JPEG;
   context -> image -> frames = 1;
   if (layout -> hierarchical) {
@@ -12,64 +23,62 @@ void load_JPEG_data (struct context * context, unsigned flags, size_t limit) {
   } else {
     if (layout -> frames[1]) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     context -> image -> width = read_be16_unaligned(context -> data + *layout -> frames + 5);
-    context -> image -> height = read_be16_unaligned(context -> data + *layout -> frames + 3);
-    for (size_t p = 0; layout -> markers[p]; p ++) if (layout -> markertype[p] == 0xdc) { // DNL marker
-      if (read_be16_unaligned(context -> data + layout -> markers[p]) != 4) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-      uint_fast16_t markerheight = read_be16_unaligned(context -> data + layout -> markers[p] + 2);
-      if (!markerheight) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-      if (!context -> image -> height)
-        context -> image -> height = markerheight;
-      else if (context -> image -> height != markerheight)
-        throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-    }
+    context -> image -> height = get_JPEG_frame_height(context, layout);
   }
+  // scaled loading only applies to DCT-based single-frame images: lossless and hierarchical images are always loaded at full size
+  size_t fullwidth = context -> image -> width, fullheight = context -> image -> height;
+  unsigned scale = 0;
+  if (!layout -> hierarchical && (*layout -> frametype & 3) != 3) scale = (flags & PLUM_JPEG_SCALE_MASK) / PLUM_JPEG_SCALE_HALF;
+  context -> image -> width = ((fullwidth - 1) >> scale) + 1;
+  context -> image -> height = ((fullheight - 1) >> scale) + 1;
   validate_image_size(context, limit);
-  size_t count = (size_t) context -> image -> width * context -> image -> height;
-  double * component_data[4] = {0};
-  for (uint_fast8_t p = 0; p < get_JPEG_component_count(components); p ++) component_data[p] = ctxmalloc(context, sizeof **component_data * count);
+  allocate_framebuffers(context, flags, false);
+  // the Exif rotation is applied while writing the decoded pixels into the image; the image's dimensions remain the decoded ones until then
+  if (layout -> Exif && !(flags & PLUM_JPEG_THUMBNAIL)) rotation = get_JPEG_rotation(context, layout -> Exif);
   unsigned bitdepth;
-  if (layout -> hierarchical)
+  if (layout -> hierarchical) {
+    // hierarchical images are decoded into whole-image component data, since each frame builds on the data decoded by previous frames
+    size_t count = (size_t) context -> image -> width * context -> image -> height;
+    double * component_data[4] = {0};
+    for (uint_fast8_t p = 0; p < get_JPEG_component_count(components); p ++) component_data[p] = ctxmalloc(context, sizeof **component_data * count);
     bitdepth = load_hierarchical_JPEG(context, layout, components, component_data);
-  else
-    bitdepth = load_single_frame_JPEG(context, layout, components, component_data);
+    write_JPEG_component_planes(context, transfer, (const double **) component_data, count, ((uint32_t) 1 << bitdepth) - 1, rotation, flags);
+    for (uint_fast8_t p = 0; p < 4; p ++) ctxfree(context, component_data[p]); // unused components will be NULL anyway
+  } else
+    bitdepth = load_single_frame_JPEG(context, layout, components, fullwidth, fullheight, scale, transfer, rotation, flags);
   append_JPEG_color_depth_metadata(context, transfer, bitdepth);
-  allocate_framebuffers(context, flags, false);
-  unsigned maxvalue = ((uint32_t) 1 << bitdepth) - 1;
-  if ((flags & PLUM_COLOR_MASK) == PLUM_COLOR_64) {
-    transfer(context -> image -> data64, count, maxvalue, (const double **) component_data);
-    if (flags & PLUM_ALPHA_INVERT) for (size_t p = 0; p < count; p ++) context -> image -> data64[p] ^= 0xffff000000000000u;
-  } else {
-    uint64_t * buffer = ctxmalloc(context, count * sizeof *buffer);
-    transfer(buffer, count, maxvalue, (const double **) component_data);
-    plum_convert_colors(context -> image -> data, buffer, count, flags, PLUM_COLOR_64);
-    ctxfree(context, buffer);
-  }
-  for (uint_fast8_t p = 0; p < 4; p ++) ctxfree(context, component_data[p]); // unused components will be NULL anyway
-  if (layout -> Exif) {
-    unsigned rotation = get_JPEG_rotation(context, layout -> Exif);
-    if (rotation) {
-      unsigned error = plum_rotate_image(context -> image, rotation & 3, rotation & 4);
-      if (error) throw(context, error);
-    }
+  if (rotation & 1) {
+    uint32_t temp = context -> image -> width;
+    context -> image -> width = context -> image -> height;
+    context -> image -> height = temp;
   }
 }
 
-struct JPEG_marker_layout * load_JPEG_marker_layout (struct context * context) {
+struct JPEG_marker_layout * load_JPEG_marker_layout (struct context * context, bool preview) {
+  // if preview is set, the data may be truncated anywhere after the first scan starts: the layout then ends where the data does
   size_t offset = 1;
   while (context -> data[offset ++] == 0xff); // the first marker must be SOI (from file type detection), so skip it
   uint_fast8_t next_restart_marker = 0; // 0 if not in a scan
-  size_t restart_offset, restart_interval, scan, frame = SIZE_MAX, markers = 0;
+  size_t restart_offset, restart_interval, restart_capacity = 0, scan, frame = SIZE_MAX, markers = 0, marker_capacity = 0;
   struct JPEG_marker_layout * layout = ctxmalloc(context, sizeof *layout);
   *layout = (struct JPEG_marker_layout) {0}; // ensure that integers and pointers are properly zero-initialized
   while (offset < context -> size) {
     size_t prev = offset;
     if (context -> data[offset ++] != 0xff)
-      if (next_restart_marker)
+      if (next_restart_marker) {
+        // entropy-coded data can only be interrupted by a 0xff byte, so skip directly to the next one
+        const unsigned char * next = memchr(context -> data + offset, 0xff, context -> size - offset);
+        offset = next ? next - context -> data : context -> size;
         continue;
-      else
+      } else
         throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     while (offset < context -> size && context -> data[offset] == 0xff) offset ++;
-    if (offset >= context -> size) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    if (offset >= context -> size) {
+      // in preview mode, trailing 0xff bytes are just the start of a marker that was cut off
+      if (!preview) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+      offset = prev;
+      break;
+    }
     uint_fast8_t marker = context -> data[offset ++];
     if (!marker)
       if (next_restart_marker)
@@ -78,26 +87,33 @@ struct JPEG_marker_layout * load_JPEG_marker_layout (struct context * context) {
         throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     if (marker < 0xc0 || marker == 0xc8 || marker == 0xd8 || (marker >= 0xf0 && marker != 0xfe)) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     if (next_restart_marker) {
-      layout -> framedata[frame][scan] = ctxrealloc(context, layout -> framedata[frame][scan], sizeof ***layout -> framedata * (restart_interval + 2));
+      // grow the array geometrically, always leaving room for the terminator that follows the last restart interval
+      if (restart_interval + 3 > restart_capacity) {
+        restart_capacity = restart_capacity ? restart_capacity * 2 : 16;
+        layout -> framedata[frame][scan] = ctxrealloc(context, layout -> framedata[frame][scan], sizeof ***layout -> framedata * restart_capacity);
+      }
       layout -> framedata[frame][scan][restart_interval ++] = restart_offset;
       layout -> framedata[frame][scan][restart_interval ++] = prev - restart_offset;
     }
-    if (marker == 0xd9) break;
     if (marker == next_restart_marker) {
       if (++ next_restart_marker == 0xd8) next_restart_marker = 0xd0;
       restart_offset = offset;
       continue;
     } else if ((marker & ~7u) == 0xd0)
       throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-    // if we find a marker other than RST, we're definitely ending the current scan, and the marker definitely has a size
+    // if we find a marker other than RST, we're definitely ending the current scan, and the marker definitely has a size (unless it is EOI)
     if (next_restart_marker) {
-      layout -> framedata[frame][scan] = ctxrealloc(context, layout -> framedata[frame][scan], sizeof ***layout -> framedata * (restart_interval + 1));
       layout -> framedata[frame][scan][restart_interval] = 0;
       next_restart_marker = 0;
     }
-    if (offset > context -> size - 2) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    if (marker == 0xd9) break;
+    if (offset > context -> size - 2 || read_be16_unaligned(context -> data + offset) > context -> size - offset) {
+      // in preview mode, a truncated marker segment simply ends the data, as long as some scan has already started
+      if (!preview || frame == SIZE_MAX || scan == SIZE_MAX) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+      break;
+    }
     uint_fast16_t marker_size = read_be16_unaligned(context -> data + offset);
-    if (marker_size < 2 || marker_size > context -> size || offset > context -> size - marker_size) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    if (marker_size < 2) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     switch (marker) {
       case 0xc0: case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6:
       case 0xc7: case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf:
@@ -124,7 +140,7 @@ struct JPEG_marker_layout * load_JPEG_marker_layout (struct context * context) {
         layout -> framescans[frame][scan] = offset;
         layout -> framedata[frame] = ctxrealloc(context, layout -> framedata[frame], sizeof **layout -> framedata * (scan + 1));
         layout -> framedata[frame][scan] = NULL;
-        restart_interval = 0;
+        restart_interval = restart_capacity = 0;
         restart_offset = offset + marker_size;
         next_restart_marker = 0xd0;
         break;
@@ -135,9 +151,13 @@ struct JPEG_marker_layout * load_JPEG_marker_layout (struct context * context) {
       case 0xdf:
         if (!layout -> hierarchical) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
       case 0xc4: case 0xcc: case 0xdb: case 0xdc: case 0xdd:
-        layout -> markers = ctxrealloc(context, layout -> markers, sizeof *layout -> markers * (markers + 1));
+        // leave room for the terminator in the markers array as well
+        if (markers + 2 > marker_capacity) {
+          marker_capacity = marker_capacity ? marker_capacity * 2 : 16;
+          layout -> markers = ctxrealloc(context, layout -> markers, sizeof *layout -> markers * marker_capacity);
+          layout -> markertype = ctxrealloc(context, layout -> markertype, sizeof *layout -> markertype * marker_capacity);
+        }
         layout -> markers[markers] = offset;
-        layout -> markertype = ctxrealloc(context, layout -> markertype, sizeof *layout -> markertype * (markers + 1));
         layout -> markertype[markers ++] = marker;
         break;
       // For JFIF, Exif and Adobe markers, all want to come "first", i.e., immediately after SOI. This is obviously impossible if more than one is present.
@@ -160,10 +180,20 @@ struct JPEG_marker_layout * load_JPEG_marker_layout (struct context * context) {
   }
   if (frame == SIZE_MAX) throw(context, PLUM_ERR_NO_DATA);
   if (scan == SIZE_MAX) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-  layout -> markers = ctxrealloc(context, layout -> markers, sizeof *layout -> markers * (markers + 1));
+  if (!marker_capacity) layout -> markers = ctxmalloc(context, sizeof *layout -> markers);
   layout -> markers[markers] = 0;
   if (next_restart_marker) {
-    layout -> framedata[frame][scan] = ctxrealloc(context, layout -> framedata[frame][scan], sizeof ***layout -> framedata * (restart_interval + 1));
+    // the data ended in the middle of a scan; in preview mode, keep whatever data that scan's last restart interval has
+    if (preview && offset > restart_offset) {
+      if (restart_interval + 3 > restart_capacity) {
+        restart_capacity = restart_interval + 3;
+        layout -> framedata[frame][scan] = ctxrealloc(context, layout -> framedata[frame][scan], sizeof ***layout -> framedata * restart_capacity);
+      }
+      layout -> framedata[frame][scan][restart_interval ++] = restart_offset;
+      layout -> framedata[frame][scan][restart_interval ++] = offset - restart_offset;
+    } else if (!restart_capacity)
+      // if that happened in its first restart interval, no array has been allocated yet
+      layout -> framedata[frame][scan] = ctxmalloc(context, sizeof ***layout -> framedata);
     layout -> framedata[frame][scan][restart_interval] = 0;
   }
   layout -> framescans[frame] = ctxrealloc(context, layout -> framescans[frame], sizeof **layout -> framescans * (++ scan + 1));
@@ -173,6 +203,21 @@ struct JPEG_marker_layout * load_JPEG_marker_layout (struct context * context) {
   return layout;
 }
 
+uint16_t get_JPEG_frame_height (struct context * context, const struct JPEG_marker_layout * layout) {
+  // for single-frame images only: the frame header may leave the height as zero, deferring it to a DNL marker
+  uint16_t height = read_be16_unaligned(context -> data + *layout -> frames + 3);
+  for (size_t p = 0; layout -> markers[p]; p ++) if (layout -> markertype[p] == 0xdc) { // DNL marker
+    if (read_be16_unaligned(context -> data + layout -> markers[p]) != 4) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    uint_fast16_t markerheight = read_be16_unaligned(context -> data + layout -> markers[p] + 2);
+    if (!markerheight) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+    if (!height)
+      height = markerheight;
+    else if (height != markerheight)
+      throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  }
+  return height;
+}
+
 unsigned get_JPEG_rotation (struct context * context, size_t offset) {
   // returns rotation count in bits 0-1 and vertical inversion in bit 2
   uint_fast16_t size = read_be16_unaligned(context -> data + offset);
@@ -207,20 +252,162 @@ unsigned get_JPEG_rotation (struct context * context, size_t offset) {
   return rotations[tag];
 }
 
-unsigned load_single_frame_JPEG (struct context * context, const struct JPEG_marker_layout * layout, uint32_t components, double ** output) {
+size_t find_JPEG_Exif_marker (struct context * context) {
+  // finds the Exif marker (i.e., the first Exif APP1 marker before any frames, like load_JPEG_marker_layout would) by only walking through the markers
+  // at the start of the file; returns 0 if the file contains no such marker
+  size_t offset = 1;
+  while (context -> data[offset ++] == 0xff); // skip the SOI marker
+  while (offset < context -> size && context -> data[offset] == 0xff) {
+    while (offset < context -> size && context -> data[offset] == 0xff) offset ++;
+    if (offset >= context -> size - 2) return 0;
+    uint_fast8_t marker = context -> data[offset ++];
+    // only tables and application data can precede the first frame (or the DHP marker, for hierarchical files)
+    if (marker != 0xc4 && marker != 0xcc && marker != 0xdb && marker != 0xdd && marker != 0xfe && (marker & 0xf0) != 0xe0) return 0;
+    uint_fast16_t marker_size = read_be16_unaligned(context -> data + offset);
+    if (marker_size < 2 || marker_size > context -> size - offset) return 0;
+    if (marker == 0xe1 && marker_size >= 16 && bytematch(context -> data + offset + 2, 0x45, 0x78, 0x69, 0x66, 0x00, 0x00)) return offset;
+    offset += marker_size;
+  }
+  return 0;
+}
+
+size_t get_JPEG_thumbnail (struct context * context, size_t offset, size_t * restrict size) {
+  // returns the location of the JPEG thumbnail stored in the Exif data's IFD1 (and its size through the size argument), or 0 if there is none
+  uint_fast16_t datasize = read_be16_unaligned(context -> data + offset) - 8;
+  const unsigned char * data = context -> data + offset + 8;
+  bool bigendian;
+  if (bytematch(data, 0x49, 0x49, 0x2a, 0x00))
+    bigendian = false;
+  else if (bytematch(data, 0x4d, 0x4d, 0x00, 0x2a))
+    bigendian = true;
+  else
+    return 0;
+  // IFD1's location follows IFD0's entries
+  uint_fast32_t pos = bigendian ? read_be32_unaligned(data + 4) : read_le32_unaligned(data + 4);
+  if (pos > datasize - 2) return 0;
+  uint_fast16_t count = bigendian ? read_be16_unaligned(data + pos) : read_le16_unaligned(data + pos);
+  if (datasize - pos - 2 < (uint_fast32_t) count * 12 + 4) return 0;
+  pos += 2 + count * 12;
+  pos = bigendian ? read_be32_unaligned(data + pos) : read_le32_unaligned(data + pos);
+  if (!pos || pos > datasize - 2) return 0;
+  count = bigendian ? read_be16_unaligned(data + pos) : read_le16_unaligned(data + pos);
+  pos += 2;
+  if (datasize - pos < (uint_fast32_t) count * 12) return 0;
+  // 0x201 and 0x202 = location and size of the JPEG thumbnail, both of them as a single LONG value
+  uint_fast32_t start = 0, length = 0;
+  for (; count; pos += 12, count --) {
+    uint_fast16_t tag = bigendian ? read_be16_unaligned(data + pos) : read_le16_unaligned(data + pos);
+    uint_fast16_t type = bigendian ? read_be16_unaligned(data + pos + 2) : read_le16_unaligned(data + pos + 2);
+    uint_fast32_t values = bigendian ? read_be32_unaligned(data + pos + 4) : read_le32_unaligned(data + pos + 4);
+    if ((tag != 0x201 && tag != 0x202) || type != 4 || values != 1) continue;
+    uint_fast32_t value = bigendian ? read_be32_unaligned(data + pos + 8) : read_le32_unaligned(data + pos + 8);
+    if (tag == 0x201)
+      start = value;
+    else
+      length = value;
+  }
+  if (!start || start > datasize || length < 8 || length > datasize - start || !bytematch(data + start, 0xff, 0xd8)) return 0;
+  *size = length;
+  return offset + 8 + start;
+}
+
+unsigned load_single_frame_JPEG (struct context * context, const struct JPEG_marker_layout * layout, uint32_t components, size_t width, size_t height,
+                                 unsigned scale, void (* transfer) (uint64_t * restrict, size_t, unsigned, const float **), unsigned rotation,
+                                 unsigned flags) {
   if (*layout -> frametype & 4) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
   struct JPEG_decoder_tables tables;
   initialize_JPEG_decoder_tables(context, &tables, layout);
   unsigned precision = context -> data[*layout -> frames + 2];
   if (precision < 2 || precision > 16) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
   size_t metadata_index = 0;
-  if (*layout -> frametype == 3 || *layout -> frametype == 11)
-    load_JPEG_lossless_frame(context, layout, components, 0, &tables, &metadata_index, output, precision, context -> image -> width, context -> image -> height);
-  else
-    load_JPEG_DCT_frame(context, layout, components, 0, &tables, &metadata_index, output, precision, context -> image -> width, context -> image -> height);
+  if (*layout -> frametype == 3 || *layout -> frametype == 11) {
+    // lossless frames are decoded into whole-image component data in double precision (since they can have up to 16 bits of precision), which is then
+    // converted into pixels
+    size_t count = width * height;
+    double * component_data[4] = {0};
+    for (uint_fast8_t p = 0; p < get_JPEG_component_count(components); p ++) component_data[p] = ctxmalloc(context, sizeof **component_data * count);
+    load_JPEG_lossless_frame(context, layout, components, 0, &tables, &metadata_index, component_data, precision, width, height);
+    write_JPEG_component_planes(context, transfer, (const double **) component_data, count, ((uint32_t) 1 << precision) - 1, rotation, flags);
+    for (uint_fast8_t p = 0; p < 4; p ++) ctxfree(context, component_data[p]);
+  } else
+    load_JPEG_DCT_frame_to_image(context, layout, components, &tables, &metadata_index, precision, width, height, scale, transfer, rotation, flags);
   return precision;
 }
 
+void write_JPEG_component_data (struct context * context, void (* transfer) (uint64_t * restrict, size_t, unsigned, const float **),
+                                const float ** components, size_t offset, size_t count, unsigned maxvalue, unsigned rotation, unsigned flags,
+                                uint64_t * restrict buffer) {
+  // converts count pixels' worth of component data into the image's pixels, starting at the pixel given by offset
+  // buffer must have room for count colors, but it is unused (and it can be NULL) if the image uses 64-bit colors and it isn't rotated
+  if (!rotation && (flags & PLUM_COLOR_MASK) == PLUM_COLOR_64) {
+    uint64_t * pixels = context -> image -> data64 + offset;
+    transfer(pixels, count, maxvalue, components);
+    if (flags & PLUM_ALPHA_INVERT) for (size_t p = 0; p < count; p ++) pixels[p] ^= 0xffff000000000000u;
+  } else {
+    transfer(buffer, count, maxvalue, components);
+    write_JPEG_pixels(context, buffer, offset, count, rotation, flags);
+  }
+}
+
+void write_JPEG_pixels (struct context * context, const uint64_t * restrict colors, size_t offset, size_t count, unsigned rotation, unsigned flags) {
+  // writes count 64-bit colors into the image's pixels, starting at the pixel given by offset; offsets refer to the image as decoded (i.e., with the image's
+  // dimensions not yet swapped by the rotation), and rotation (in the format returned by get_JPEG_rotation) determines where each pixel ends up
+  if (!rotation) {
+    plum_convert_colors(context -> image -> data8 + plum_color_buffer_size(offset, flags), colors, count, flags, PLUM_COLOR_64);
+    return;
+  }
+  // each decoded row maps to a straight line of pixels in the rotated image: its first pixel ends up at index start, and the following ones are step
+  // pixels apart from each other
+  size_t width = context -> image -> width, height = context -> image -> height;
+  for (size_t row = offset / width, col = offset % width; count; row ++, col = 0) {
+    size_t start;
+    ptrdiff_t step;
+    switch (rotation) {
+      case 1: start = height - 1 - row;                  step = height;  break;
+      case 2: start = (height - row) * width - 1;        step = -1;      break;
+      case 3: start = (width - 1) * height + row;        step = -(ptrdiff_t) height; break;
+      case 4: start = (height - 1 - row) * width;        step = 1;       break;
+      case 5: start = width * height - 1 - row;          step = -(ptrdiff_t) height; break;
+      case 6: start = (row + 1) * width - 1;             step = -1;      break;
+      default: start = row;                              step = height; // rotation = 7
+    }
+    size_t remaining = (count < width - col) ? count : width - col;
+    count -= remaining;
+    for (size_t index = start + col * step; remaining; remaining --, index += step) {
+      uint64_t color = plum_convert_color(*(colors ++), PLUM_COLOR_64, flags);
+      if ((flags & PLUM_COLOR_MASK) == PLUM_COLOR_64)
+        context -> image -> data64[index] = color;
+      else if ((flags & PLUM_COLOR_MASK) == PLUM_COLOR_16)
+        context -> image -> data16[index] = color;
+      else
+        context -> image -> data32[index] = color;
+    }
+  }
+}
+
+void write_JPEG_component_planes (struct context * context, void (* transfer) (uint64_t * restrict, size_t, unsigned, const float **),
+                                  const double ** components, size_t count, unsigned maxvalue, unsigned rotation, unsigned flags) {
+  // converts whole-image component data (used for lossless and hierarchical images, which are decoded in double precision) into the image's pixels; the
+  // color conversion is also done in double precision, since these images can have up to 16 bits of precision
+  void (* transfer_double) (uint64_t * restrict, size_t, unsigned, const double **) = get_JPEG_double_transfer_function(transfer);
+  if (!rotation && (flags & PLUM_COLOR_MASK) == PLUM_COLOR_64) {
+    transfer_double(context -> image -> data64, count, maxvalue, components);
+    if (flags & PLUM_ALPHA_INVERT) for (size_t p = 0; p < count; p ++) context -> image -> data64[p] ^= 0xffff000000000000u;
+    return;
+  }
+  // otherwise, convert the colors in chunks of up to 0x1000 pixels, so that the intermediate buffer doesn't need to hold the whole image
+  size_t chunk = (count < 0x1000) ? count : 0x1000;
+  uint64_t * buffer = ctxmalloc(context, sizeof *buffer * chunk);
+  for (size_t offset = 0; offset < count; offset += chunk) {
+    size_t size = (count - offset < chunk) ? count - offset : chunk;
+    const double * chunkdata[4] = {0};
+    for (uint_fast8_t p = 0; p < 4 && components[p]; p ++) chunkdata[p] = components[p] + offset;
+    transfer_double(buffer, size, maxvalue, chunkdata);
+    write_JPEG_pixels(context, buffer, offset, size, rotation, flags);
+  }
+  ctxfree(context, buffer);
+}
+
 unsigned char process_JPEG_metadata_until_offset (struct context * context, const struct JPEG_marker_layout * layout, struct JPEG_decoder_tables * tables,
                                                   size_t * restrict index, size_t limit) {
   unsigned char expansion = 0;
@@ -3,10 +3,112 @@
 void load_JPEG_DCT_frame (struct context * context, const struct JPEG_marker_layout * layout, uint32_t components, size_t frameindex,
                           struct JPEG_decoder_tables * tables, size_t * restrict metadata_index, double ** output, unsigned precision, size_t width,
                           size_t height) {
+  struct JPEG_DCT_frame frame;
+  decode_JPEG_DCT_frame(context, layout, components, frameindex, tables, metadata_index, precision, width, height, false, &frame);
+  // if the frame is non-differential, initialize all components in the final image to the level shift value
+  if (!(layout -> frametype[frameindex] & 4)) {
+    double levelshift = 1u << (precision - 1);
+    for (uint_fast8_t p = 0; p < frame.count; p ++) for (size_t i = 0; i < width * height; i ++) output[p][i] = levelshift;
+  }
+  // transform all blocks into component data and add it to the output (level shift value for non-differential frames, previous values for differential frames)
+  // loop backwards so DCT data is released in reverse allocation order after transforming it into output data
+  while (frame.count --) {
+    const struct JPEG_component_info * info = frame.component_info + frame.count;
+    size_t compwidth = frame.unitrow * info -> scaleH * 8 + 2, compheight = frame.unitcol * info -> scaleV * 8 + 2;
+    double * transformed = ctxmalloc(context, sizeof *transformed * compwidth * compheight); // component data buffer, plus a pixel of padding around the edges
+    // apply the reverse DCT to each block, transforming it into component data, and store it in the correct location in the component data buffer
+    for (size_t y = 0; y < frame.unitcol * info -> scaleV; y ++) for (size_t x = 0; x < frame.unitrow * info -> scaleH; x ++)
+      transform_JPEG_block_double(transformed + (y * 8 + 1) * compwidth + x * 8 + 1, compwidth,
+                                  frame.component_data[frame.count][y * frame.unitrow * info -> scaleH + x], tables -> quantization[info -> tableQ], 0);
+    // scale up subsampled components and add them to the output
+    unpack_JPEG_component(output[frame.count], transformed, width, height, compwidth, compheight, info -> scaleH, info -> scaleV, frame.maxH, frame.maxV);
+    ctxfree(context, transformed);
+    ctxfree(context, frame.component_data[frame.count]);
+  }
+}
+
+void load_JPEG_DCT_frame_to_image (struct context * context, const struct JPEG_marker_layout * layout, uint32_t components,
+                                   struct JPEG_decoder_tables * tables, size_t * restrict metadata_index, unsigned precision, size_t width, size_t height,
+                                   unsigned scale, void (* transfer) (uint64_t * restrict, size_t, unsigned, const float **), unsigned rotation,
+                                   unsigned flags) {
+  // loads a non-differential frame directly into the image's pixels; only the DCT coefficients are stored for the whole frame, while the remaining stages
+  // (IDCT, upsampling, color conversion) are applied to one row of MCUs at a time, so no whole-image component data buffers are needed
+  // scale is a shift count: the frame is reduced by a factor of 2 ** scale in each dimension (reduced IDCTs generate 8 >> scale pixels per block)
+  // since DCT frames have a precision of at most 12 bits (barring non-standard files), component data is stored in single precision
+  struct JPEG_DCT_frame frame;
+  decode_JPEG_DCT_frame(context, layout, components, 0, tables, metadata_index, precision, width, height, flags & PLUM_JPEG_PREVIEW, &frame);
+  size_t outwidth = context -> image -> width, outheight = context -> image -> height;
+  uint_fast8_t blocksize = 8 >> scale;
+  size_t striprows = frame.maxV * blocksize; // output rows generated by each row of MCUs
+  // YCbCr images with common subsampling modes (4:4:4, 4:2:2, 4:2:0) are upsampled and converted to colors in a single pass, without strip buffers
+  const struct JPEG_component_info * info = frame.component_info;
+  bool fused = transfer == &JPEG_transfer_YCbCr_float && info -> scaleH == frame.maxH && info -> scaleV == frame.maxV &&
+               info[1].scaleH == info[2].scaleH && info[1].scaleV == info[2].scaleV &&
+               (frame.maxH == info[1].scaleH || frame.maxH == 2 * info[1].scaleH) && (frame.maxV == info[1].scaleV || frame.maxV == 2 * info[1].scaleV);
+  // for each component, the window contains the last row of the previous row of MCUs (or padding), followed by two rows of MCUs: the one being output and
+  // the following one (needed because upsampling interpolates across MCU boundaries); each row has a pixel of padding on each side
+  float * window[4] = {0};
+  float * strip[4] = {0};
+  size_t compwidth[4], comprows[4];
+  for (uint_fast8_t p = 0; p < frame.count; p ++) {
+    compwidth[p] = frame.unitrow * info[p].scaleH * blocksize + 2;
+    comprows[p] = info[p].scaleV * blocksize;
+    window[p] = ctxmalloc(context, sizeof **window * compwidth[p] * (2 * comprows[p] + 1));
+    if (!fused) strip[p] = ctxmalloc(context, sizeof **strip * outwidth * striprows);
+    transform_JPEG_MCU_row(window[p] + compwidth[p], compwidth[p], &frame, p, 0, tables -> quantization[info[p].tableQ], scale);
+    memcpy(window[p], window[p] + compwidth[p], sizeof **window * compwidth[p]);
+  }
+  // when fusing, the first strip buffer is used for the chroma rows used by write_JPEG_YCbCr_strip instead
+  if (fused) *strip = ctxmalloc(context, sizeof **strip * (2 * outwidth + compwidth[1]));
+  size_t buffersize = fused ? outwidth : outwidth * striprows;
+  uint64_t * buffer = (!rotation && (flags & PLUM_COLOR_MASK) == PLUM_COLOR_64) ? NULL : ctxmalloc(context, sizeof *buffer * buffersize);
+  float levelshift = 1u << (precision - 1);
+  unsigned maxvalue = ((uint32_t) 1 << precision) - 1;
+  for (size_t unit = 0; unit < frame.unitcol; unit ++) {
+    // the last row of MCUs may extend past the bottom of the image, but all others are entirely within it
+    size_t rows = (outheight - unit * striprows < striprows) ? outheight - unit * striprows : striprows;
+    for (uint_fast8_t p = 0; p < frame.count; p ++) {
+      float * nextrow = window[p] + (comprows[p] + 1) * compwidth[p];
+      if (unit + 1 < frame.unitcol)
+        transform_JPEG_MCU_row(nextrow, compwidth[p], &frame, p, unit + 1, tables -> quantization[info[p].tableQ], scale);
+      else
+        memcpy(nextrow, nextrow - compwidth[p], sizeof **window * compwidth[p]);
+      for (size_t row = 0; row < comprows[p] + 2; row ++) {
+        window[p][row * compwidth[p]] = window[p][row * compwidth[p] + 1];
+        window[p][(row + 1) * compwidth[p] - 1] = window[p][(row + 1) * compwidth[p] - 2];
+      }
+      if (!fused) {
+        for (size_t index = 0; index < rows * outwidth; index ++) strip[p][index] = levelshift;
+        interpolate_JPEG_component_float(strip[p], window[p], outwidth, rows, compwidth[p], info[p].scaleH, info[p].scaleV, frame.maxH, frame.maxV);
+      }
+    }
+    if (fused)
+      write_JPEG_YCbCr_strip(context, window, compwidth, unit * striprows, rows, frame.maxH / info[1].scaleH, frame.maxV / info[1].scaleV, levelshift,
+                             maxvalue, rotation, flags, *strip, buffer);
+    else
+      write_JPEG_component_data(context, transfer, (const float **) strip, unit * striprows * outwidth, rows * outwidth, maxvalue, rotation, flags,
+                                buffer);
+    // shift the windows down by a row of MCUs: the last row of the current row of MCUs becomes the top padding row
+    for (uint_fast8_t p = 0; p < frame.count; p ++)
+      memmove(window[p], window[p] + comprows[p] * compwidth[p], sizeof **window * compwidth[p] * (comprows[p] + 1));
+  }
+  ctxfree(context, buffer);
+  for (uint_fast8_t p = frame.count; p; p --) {
+    ctxfree(context, strip[p - 1]);
+    ctxfree(context, window[p - 1]);
+  }
+  for (uint_fast8_t p = frame.count; p; p --) ctxfree(context, frame.component_data[p - 1]);
+}
+
+void decode_JPEG_DCT_frame (struct context * context, const struct JPEG_marker_layout * layout, uint32_t components, size_t frameindex,
+                            struct JPEG_decoder_tables * tables, size_t * restrict metadata_index, unsigned precision, size_t width, size_t height,
+                            bool preview, struct JPEG_DCT_frame * restrict frame) {
+  // if preview is set, decoding stops as soon as all components have DC coefficients (for progressive frames, this is usually after the first scan), and
+  // all coefficients that haven't been decoded by then are left as zero
   const size_t * scans = layout -> framescans[frameindex];
   const size_t ** offsets = (const size_t **) layout -> framedata[frameindex];
   // obtain this frame's components' parameters and compute the number of (non-subsampled) blocks per MCU (maximum scale factor for each dimension)
-  struct JPEG_component_info component_info[4];
+  struct JPEG_component_info * component_info = frame -> component_info;
   uint_fast8_t maxH = 1, maxV = 1, count = get_JPEG_component_info(context, context -> data + layout -> frames[frameindex], component_info, components);
   for (uint_fast8_t p = 0; p < count; p ++) {
     if (component_info[p].scaleV > maxV) maxV = component_info[p].scaleV;
@@ -14,9 +116,18 @@ void load_JPEG_DCT_frame (struct context * context, const struct JPEG_marker_lay
   }
   // compute the image dimensions in MCUs and allocate space for that many coefficients for each component (including padding blocks to fill up edge MCUs)
   size_t unitrow = (width - 1) / (8 * maxH) + 1, unitcol = (height - 1) / (8 * maxV) + 1, units = unitrow * unitcol;
-  int16_t (* restrict component_data[4])[64] = {0};
-  for (uint_fast8_t p = 0; p < count; p ++)
-    component_data[p] = ctxmalloc(context, sizeof **component_data * units * component_info[p].scaleH * component_info[p].scaleV);
+  int16_t (* restrict * component_data)[64] = frame -> component_data;
+  for (uint_fast8_t p = 0; p < 4; p ++) component_data[p] = NULL;
+  for (uint_fast8_t p = 0; p < count; p ++) {
+    size_t size = sizeof **component_data * units * component_info[p].scaleH * component_info[p].scaleV;
+    component_data[p] = ctxmalloc(context, size);
+    if (preview) memset(component_data[p], 0, size);
+  }
+  frame -> unitrow = unitrow;
+  frame -> unitcol = unitcol;
+  frame -> count = count;
+  frame -> maxH = maxH;
+  frame -> maxV = maxV;
   unsigned char currentbits[4][64]; // successive approximation bit positions for each component and coefficient, for progressive scans
   memset(currentbits, 0xff, sizeof currentbits); // 0xff = no data yet (i.e., the coefficient hasn't shown up yet in any scans)
   for (; *scans; scans ++, offsets ++) {
@@ -58,35 +169,55 @@ void load_JPEG_DCT_frame (struct context * context, const struct JPEG_marker_lay
         decompress_JPEG_arithmetic_bit_scan(context, &state, scanunitrow, component_info, *offsets, bitend, first, last);
       else
         decompress_JPEG_Huffman_bit_scan(context, &state, tables, scanunitrow, component_info, *offsets, bitend, first, last);
+    if (preview) {
+      uint_fast8_t p;
+      for (p = 0; p < count && currentbits[p][0] != 0xff; p ++);
+      if (p == count) return;
+    }
   }
   // ensure that the frame's scans contain all bits for all coefficients, for each one of its components
   for (uint_fast8_t p = 0; p < count; p ++) for (uint_fast8_t coefficient = 0; coefficient < 64; coefficient ++)
     if (currentbits[p][coefficient]) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-  // if the frame is non-differential, initialize all components in the final image to the level shift value
-  if (!(layout -> frametype[frameindex] & 4)) {
-    double levelshift = 1u << (precision - 1);
-    for (uint_fast8_t p = 0; p < count; p ++) for (size_t i = 0; i < width * height; i ++) output[p][i] = levelshift;
-  }
-  // transform all blocks into component data and add it to the output (level shift value for non-differential frames, previous values for differential frames)
-  // loop backwards so DCT data is released in reverse allocation order after transforming it into output data
-  while (count --) {
-    size_t compwidth = unitrow * component_info[count].scaleH * 8 + 2, compheight = unitcol * component_info[count].scaleV * 8 + 2;
-    double * transformed = ctxmalloc(context, sizeof *transformed * compwidth * compheight); // component data buffer, plus a pixel of padding around the edges
-    for (size_t y = 0; y < unitcol * component_info[count].scaleV; y ++) for (size_t x = 0; x < unitrow * component_info[count].scaleH; x ++) {
-      // apply the reverse DCT to each block, transforming it into component data
-      double buffer[64];
-      apply_JPEG_inverse_DCT(buffer, component_data[count][y * unitrow * component_info[count].scaleH + x], tables -> quantization[component_info[count].tableQ]);
-      // copy the block's data to the correct location in the component data buffer (accounting for the padding)
-      double * current = transformed + (y * 8 + 1) * compwidth + x * 8 + 1;
-      for (uint_fast8_t row = 0; row < 8; row ++) memcpy(current + compwidth * row, buffer + 8 * row, sizeof *buffer * 8);
-    }
-    // scale up subsampled components and add them to the output
-    unpack_JPEG_component(output[count], transformed, width, height, compwidth, compheight, component_info[count].scaleH, component_info[count].scaleV, maxH, maxV);
-    ctxfree(context, transformed);
-    ctxfree(context, component_data[count]);
-  }
 }
 
+void transform_JPEG_MCU_row (float * restrict output, size_t stride, const struct JPEG_DCT_frame * frame, uint_fast8_t component, size_t unit,
+                             const uint16_t * restrict quantization, unsigned scale) {
+  // transforms all of a component's blocks in a row of MCUs into component data; output points to the first row (after the padding pixel on the left)
+  uint_fast8_t blocksize = 8 >> scale, scaleH = frame -> component_info[component].scaleH, scaleV = frame -> component_info[component].scaleV;
+  size_t blockrow = frame -> unitrow * scaleH;
+  int16_t (* blocks)[64] = frame -> component_data[component] + unit * scaleV * blockrow;
+  for (uint_fast8_t y = 0; y < scaleV; y ++) for (size_t x = 0; x < blockrow; x ++)
+    transform_JPEG_block_float(output + y * blocksize * stride + x * blocksize + 1, stride, blocks[y * blockrow + x], quantization, scale);
+}
+
+// apply the reverse DCT to a block, storing the resulting (8 >> scale) x (8 >> scale) component data at output (with rows stride values apart); blocks
+// with only a DC coefficient become a constant fill, and other sparse blocks use a reduced transform
+// the transform itself is always computed in double precision; the type parameter only determines how the results are stored
+#define TRANSFORM_JPEG_BLOCK_FUNCTION(type)                                                                                                              \
+void transform_JPEG_block_ ## type (type * restrict output, size_t stride, const int16_t block[restrict static 64],                                      \
+                                    const uint16_t quantization[restrict static 64], unsigned scale) {                                                   \
+  uint_fast8_t last = 63;                                                                                                                                \
+  while (last && !block[last]) last --;                                                                                                                  \
+  if (scale) {                                                                                                                                           \
+    uint_fast8_t size = 8 >> scale;                                                                                                                      \
+    double buffer[16];                                                                                                                                   \
+    apply_JPEG_reduced_inverse_DCT(buffer, block, quantization, last, size);                                                                             \
+    for (uint_fast8_t row = 0; row < size; row ++) for (uint_fast8_t col = 0; col < size; col ++) output[stride * row + col] = buffer[size * row + col]; \
+  } else if (last) {                                                                                                                                     \
+    double buffer[64];                                                                                                                                   \
+    apply_JPEG_inverse_DCT(buffer, block, quantization, last);                                                                                           \
+    for (uint_fast8_t row = 0; row < 8; row ++) for (uint_fast8_t col = 0; col < 8; col ++) output[stride * row + col] = buffer[8 * row + col];          \
+  } else {                                                                                                                                               \
+    type value = (double) *block * *quantization / 8;                                                                                                    \
+    for (uint_fast8_t row = 0; row < 8; row ++) for (uint_fast8_t col = 0; col < 8; col ++) output[stride * row + col] = value;                          \
+  }                                                                                                                                                      \
+}
+
+TRANSFORM_JPEG_BLOCK_FUNCTION(float)
+TRANSFORM_JPEG_BLOCK_FUNCTION(double)
+
+#undef TRANSFORM_JPEG_BLOCK_FUNCTION
+
 void load_JPEG_lossless_frame (struct context * context, const struct JPEG_marker_layout * layout, uint32_t components, size_t frameindex,
                                struct JPEG_decoder_tables * tables, size_t * restrict metadata_index, double ** output, unsigned precision, size_t width,
                                size_t height) {
@@ -198,50 +329,60 @@ void unpack_JPEG_component (double * restrict result, double * restrict source,
     source[p * scaled_width] = source[p * scaled_width + 1];
     source[(p + 1) * scaled_width - 1] = source[(p + 1) * scaled_width - 2];
   }
-  // if the scaling parameters form a reducible fraction, reduce it
-  if (scaleH == maxH)
-    scaleH = maxH = 1;
-  else if (maxH == 4 && scaleH == 2) {
-    maxH = 2;
-    scaleH = 1;
-  }
-  if (scaleV == maxV)
-    scaleV = maxV = 1;
-  else if (maxV == 4 && scaleV == 2) {
-    maxV = 2;
-    scaleV = 1;
-  }
-  // indexes into the interpolation index lists: 1-4 for integer ratios (scale = 1 after normalization above), 0 for 3/2, 5 for 4/3
-  unsigned char indexH = (scaleH == 2) ? 0 : (scaleH == 3) ? 5 : maxH, indexV = (scaleV == 2) ? 0 : (scaleV == 3) ? 5 : maxV;
-  // weights for all possible scaling factors (3/2, 1 to 4, 4/3); a subset of these will be selected for each axis depending on the actual scale factor
-  static const double interpolation_weights[] = {0x0.55555555555558p+0, 0x0.aaaaaaaaaaaaa8p+0, 1.0, 0x0.aaaaaaaaaaaaa8p+0, 0x0.55555555555558p+0, 0.0,
-                                                 0x0.4p+0, 0x0.cp+0, 0x0.4p+0, 0x0.2aaaaaaaaaaaa8p+0, 0x0.8p+0, 0x0.d5555555555558p+0, 0x0.8p+0,
-                                                 0x0.2aaaaaaaaaaaa8p+0, 0x0.2p+0, 0x0.6p+0, 0x0.ap+0, 0x0.ep+0, 0x0.ap+0, 0x0.6p+0, 0x0.2p+0};
-  static const unsigned char first_interpolation_indexes[] = {9, 5, 7, 3, 17, 14};
-  static const unsigned char second_interpolation_indexes[] = {11, 2, 6, 0, 14, 17};
-  // actual interpolation weights for each pixel in a row/column of upscaled pixels
-  const double * firstH = interpolation_weights + first_interpolation_indexes[indexH];
-  const double * firstV = interpolation_weights + first_interpolation_indexes[indexV];
-  const double * secondH = interpolation_weights + second_interpolation_indexes[indexH];
-  const double * secondV = interpolation_weights + second_interpolation_indexes[indexV];
-  // scale up the component, as determined by the scale parameters, by interpolating the decoded data
-  unsigned char offsetV = maxV / (2 * scaleV), offsetH = maxH / (2 * scaleH);
-  for (size_t p = 0, sourceY = 0, row = 0; row < height; row ++) {
-    for (size_t sourceX = 0, col = 0; col < width; col ++) {
-      result[p ++] += source[sourceX + sourceY * scaled_width] * firstH[offsetH] * firstV[offsetV] +
-                      source[sourceX + 1 + sourceY * scaled_width] * secondH[offsetH] * firstV[offsetV] +
-                      source[sourceX + (sourceY + 1) * scaled_width] * firstH[offsetH] * secondV[offsetV] +
-                      source[sourceX + 1 + (sourceY + 1) * scaled_width] * secondH[offsetH] * secondV[offsetV];
-      if (++ offsetH == maxH) {
-        offsetH = 0;
-        if (scaleH == 1) sourceX ++;
-      } else if (scaleH != 1)
-        sourceX ++;
-    }
-    if (++ offsetV == maxV) {
-      offsetV = 0;
-      if (scaleV == 1) sourceY ++;
-    } else if (scaleV != 1)
-      sourceY ++;
-  }
+  interpolate_JPEG_component_double(result, source, width, height, scaled_width, scaleH, scaleV, maxH, maxV);
+}
+
+// scales up a component (with its padding already filled in), adding the interpolated values to the result
+// the interpolation weights for each axis are selected from a table of weights for all possible scaling factors (3/2, 1 to 4, 4/3), indexed by 1-4 for
+// integer ratios (scale = 1 after reducing the fraction), 0 for 3/2 and 5 for 4/3
+#define INTERPOLATE_JPEG_COMPONENT_FUNCTION(type)                                                                                                    \
+void interpolate_JPEG_component_ ## type (type * restrict result, const type * restrict source, size_t width, size_t height, size_t scaled_width,    \
+                                          unsigned char scaleH, unsigned char scaleV, unsigned char maxH, unsigned char maxV) {                      \
+  if (scaleH == maxH)                                                                                                                                \
+    scaleH = maxH = 1;                                                                                                                               \
+  else if (maxH == 4 && scaleH == 2) {                                                                                                               \
+    maxH = 2;                                                                                                                                        \
+    scaleH = 1;                                                                                                                                      \
+  }                                                                                                                                                  \
+  if (scaleV == maxV)                                                                                                                                \
+    scaleV = maxV = 1;                                                                                                                               \
+  else if (maxV == 4 && scaleV == 2) {                                                                                                               \
+    maxV = 2;                                                                                                                                        \
+    scaleV = 1;                                                                                                                                      \
+  }                                                                                                                                                  \
+  unsigned char indexH = (scaleH == 2) ? 0 : (scaleH == 3) ? 5 : maxH, indexV = (scaleV == 2) ? 0 : (scaleV == 3) ? 5 : maxV;                        \
+  static const type interpolation_weights[] = {0x0.55555555555558p+0, 0x0.aaaaaaaaaaaaa8p+0, 1.0, 0x0.aaaaaaaaaaaaa8p+0, 0x0.55555555555558p+0, 0.0, \
+                                               0x0.4p+0, 0x0.cp+0, 0x0.4p+0, 0x0.2aaaaaaaaaaaa8p+0, 0x0.8p+0, 0x0.d5555555555558p+0, 0x0.8p+0,       \
+                                               0x0.2aaaaaaaaaaaa8p+0, 0x0.2p+0, 0x0.6p+0, 0x0.ap+0, 0x0.ep+0, 0x0.ap+0, 0x0.6p+0, 0x0.2p+0};         \
+  static const unsigned char first_interpolation_indexes[] = {9, 5, 7, 3, 17, 14};                                                                   \
+  static const unsigned char second_interpolation_indexes[] = {11, 2, 6, 0, 14, 17};                                                                 \
+  const type * firstH = interpolation_weights + first_interpolation_indexes[indexH];                                                                 \
+  const type * firstV = interpolation_weights + first_interpolation_indexes[indexV];                                                                 \
+  const type * secondH = interpolation_weights + second_interpolation_indexes[indexH];                                                               \
+  const type * secondV = interpolation_weights + second_interpolation_indexes[indexV];                                                               \
+  unsigned char offsetV = maxV / (2 * scaleV);                                                                                                       \
+  for (size_t p = 0, sourceY = 0, row = 0; row < height; row ++) {                                                                                   \
+    unsigned char offsetH = maxH / (2 * scaleH);                                                                                                     \
+    for (size_t sourceX = 0, col = 0; col < width; col ++) {                                                                                         \
+      result[p ++] += source[sourceX + sourceY * scaled_width] * firstH[offsetH] * firstV[offsetV] +                                                 \
+                      source[sourceX + 1 + sourceY * scaled_width] * secondH[offsetH] * firstV[offsetV] +                                            \
+                      source[sourceX + (sourceY + 1) * scaled_width] * firstH[offsetH] * secondV[offsetV] +                                          \
+                      source[sourceX + 1 + (sourceY + 1) * scaled_width] * secondH[offsetH] * secondV[offsetV];                                      \
+      if (++ offsetH == maxH) {                                                                                                                      \
+        offsetH = 0;                                                                                                                                 \
+        if (scaleH == 1) sourceX ++;                                                                                                                 \
+      } else if (scaleH != 1)                                                                                                                        \
+        sourceX ++;                                                                                                                                  \
+    }                                                                                                                                                \
+    if (++ offsetV == maxV) {                                                                                                                        \
+      offsetV = 0;                                                                                                                                   \
+      if (scaleV == 1) sourceY ++;                                                                                                                   \
+    } else if (scaleV != 1)                                                                                                                          \
+      sourceY ++;                                                                                                                                    \
+  }                                                                                                                                                  \
 }
+
+INTERPOLATE_JPEG_COMPONENT_FUNCTION(float)
+INTERPOLATE_JPEG_COMPONENT_FUNCTION(double)
+
+#undef INTERPOLATE_JPEG_COMPONENT_FUNCTION
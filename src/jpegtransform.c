@@ -0,0 +1,279 @@
+#include "proto.h"
+
+size_t plum_transform_JPEG (const void * restrict input, size_t input_size_mode, void * restrict output, size_t output_size_mode, unsigned count,
+                            int flip, const struct plum_rectangle * restrict crop, unsigned * restrict error) {
+  struct context * context = create_context();
+  if (!context) {
+    if (error) *error = PLUM_ERR_OUT_OF_MEMORY;
+    return 0;
+  }
+  size_t result = 0;
+  if (!setjmp(context -> target)) {
+    if (!(input && output && output_size_mode)) throw(context, PLUM_ERR_INVALID_ARGUMENTS);
+    prepare_image_buffer_data(context, input, input_size_mode);
+    transform_JPEG_data(context, count, flip, crop);
+    result = write_generated_image_output(context, output, output_size_mode);
+  }
+  if (context -> file) fclose(context -> file);
+  if (error) *error = context -> status;
+  destroy_allocator_list(context -> allocator);
+  return result;
+}
+
+size_t plum_requantize_JPEG (const void * restrict input, size_t input_size_mode, void * restrict output, size_t output_size_mode, unsigned quality,
+                             unsigned * restrict error) {
+  struct context * context = create_context();
+  if (!context) {
+    if (error) *error = PLUM_ERR_OUT_OF_MEMORY;
+    return 0;
+  }
+  size_t result = 0;
+  if (!setjmp(context -> target)) {
+    if (!(input && output && output_size_mode) || !quality || quality > 100) throw(context, PLUM_ERR_INVALID_ARGUMENTS);
+    prepare_image_buffer_data(context, input, input_size_mode);
+    requantize_JPEG_data(context, quality);
+    result = write_generated_image_output(context, output, output_size_mode);
+  }
+  if (context -> file) fclose(context -> file);
+  if (error) *error = context -> status;
+  destroy_allocator_list(context -> allocator);
+  return result;
+}
+
+void transform_JPEG_data (struct context * context, unsigned count, bool flip, const struct plum_rectangle * restrict crop) {
+  struct JPEG_decoder_tables tables;
+  struct JPEG_DCT_frame source, frame;
+  size_t width, height;
+  unsigned precision = load_JPEG_coefficients(context, &source, &tables, &width, &height);
+  // every rotation and flip is a combination of a transposition (bit 0) and horizontal and vertical reflections (bits 1 and 2) of the output
+  static const unsigned char transformations[] = {0, 3, 6, 5, 4, 7, 2, 1};
+  uint_fast8_t transformation = transformations[(count & 3) + 4 * !!flip];
+  bool transpose = transformation & 1, mirrorH = transformation & 2, mirrorV = transformation & 4;
+  // reflecting the image would move the partial MCUs along the right and bottom edges to the left and top edges, which cannot be represented; therefore,
+  // reflected dimensions are trimmed to a whole number of MCUs, and images that are smaller than a single MCU along a reflected dimension are rejected
+  // (since reflecting them would bring the padding into view)
+  if (transpose ? mirrorV : mirrorH) {
+    if (width < 8 * source.maxH) throw(context, PLUM_ERR_INVALID_ARGUMENTS);
+    width -= width % (8 * source.maxH);
+  }
+  if (transpose ? mirrorH : mirrorV) {
+    if (height < 8 * source.maxV) throw(context, PLUM_ERR_INVALID_ARGUMENTS);
+    height -= height % (8 * source.maxV);
+  }
+  if (transpose) swap(size_t, width, height);
+  frame.count = source.count;
+  frame.maxH = transpose ? source.maxV : source.maxH;
+  frame.maxV = transpose ? source.maxH : source.maxV;
+  for (uint_fast8_t p = 0; p < frame.count; p ++) {
+    frame.component_info[p] = source.component_info[p];
+    if (transpose) {
+      frame.component_info[p].scaleH = source.component_info[p].scaleV;
+      frame.component_info[p].scaleV = source.component_info[p].scaleH;
+    }
+  }
+  // the crop area (given in output coordinates) is extended up and left to the nearest MCU boundary, since the MCU grid cannot be shifted
+  size_t left = 0, top = 0, fullwidth = width, fullheight = height;
+  if (crop) {
+    if (!(crop -> width && crop -> height) || crop -> left >= width || crop -> top >= height || crop -> width > width - crop -> left ||
+        crop -> height > height - crop -> top) throw(context, PLUM_ERR_INVALID_ARGUMENTS);
+    left = crop -> left - crop -> left % (8 * frame.maxH);
+    top = crop -> top - crop -> top % (8 * frame.maxV);
+    width = crop -> left + crop -> width - left;
+    height = crop -> top + crop -> height - top;
+  }
+  frame.unitrow = (width - 1) / (8 * frame.maxH) + 1;
+  frame.unitcol = (height - 1) / (8 * frame.maxV) + 1;
+  // for each output coefficient (in zigzag order), compute the corresponding coefficient in the source block and whether its sign must be inverted
+  // (reflecting a block along an axis negates all odd frequencies for that axis)
+  unsigned char zigzag[64], coefficients[64];
+  bool negated[64];
+  for (uint_fast8_t p = 0; p < 64; p ++) zigzag[JPEG_zigzag_rows[p] * 8 + JPEG_zigzag_columns[p]] = p;
+  for (uint_fast8_t p = 0; p < 64; p ++) {
+    uint_fast8_t row = JPEG_zigzag_rows[p], col = JPEG_zigzag_columns[p];
+    coefficients[p] = transpose ? zigzag[col * 8 + row] : p;
+    negated[p] = (mirrorH && (col & 1)) != (mirrorV && (row & 1));
+  }
+  // transposed coefficients need transposed quantization tables as well (the decoder is done with them, so they can be updated in place)
+  if (transpose) for (uint_fast8_t table = 0; table < 4; table ++) if (tables.quantization[table]) {
+    uint16_t buffer[64];
+    for (uint_fast8_t p = 0; p < 64; p ++) buffer[p] = tables.quantization[table][coefficients[p]];
+    memcpy(tables.quantization[table], buffer, sizeof buffer);
+  }
+  for (uint_fast8_t p = 0; p < frame.count; p ++) {
+    const struct JPEG_component_info * info = frame.component_info + p;
+    size_t blockrow = frame.unitrow * info -> scaleH, sourcerow = source.unitrow * source.component_info[p].scaleH;
+    frame.component_data[p] = ctxmalloc(context, sizeof **frame.component_data * blockrow * frame.unitcol * info -> scaleV);
+    // only the blocks covered by the component in the output are generated, since the remaining (padding) blocks are never encoded
+    size_t blockswide = (width * info -> scaleH - 1) / frame.maxH / 8 + 1, blockshigh = (height * info -> scaleV - 1) / frame.maxV / 8 + 1;
+    size_t fullwide = (fullwidth * info -> scaleH - 1) / frame.maxH / 8 + 1, fullhigh = (fullheight * info -> scaleV - 1) / frame.maxV / 8 + 1;
+    size_t offsetH = left / (8 * frame.maxH) * info -> scaleH, offsetV = top / (8 * frame.maxV) * info -> scaleV;
+    for (size_t row = 0; row < blockshigh; row ++) for (size_t col = 0; col < blockswide; col ++) {
+      size_t x = col + offsetH, y = row + offsetV;
+      if (mirrorH) x = fullwide - 1 - x;
+      if (mirrorV) y = fullhigh - 1 - y;
+      const int16_t * block = source.component_data[p][transpose ? x * sourcerow + y : y * sourcerow + x];
+      int16_t * target = frame.component_data[p][row * blockrow + col];
+      for (uint_fast8_t coefficient = 0; coefficient < 64; coefficient ++)
+        target[coefficient] = negated[coefficient] ? -block[coefficients[coefficient]] : block[coefficients[coefficient]];
+    }
+  }
+  for (uint_fast8_t p = 0; p < source.count; p ++) ctxfree(context, source.component_data[p]);
+  generate_transcoded_JPEG_data(context, &frame, tables.quantization, width, height, precision);
+  for (uint_fast8_t p = 0; p < frame.count; p ++) ctxfree(context, frame.component_data[p]);
+}
+
+void requantize_JPEG_data (struct context * context, unsigned quality) {
+  struct JPEG_decoder_tables tables;
+  struct JPEG_DCT_frame frame;
+  size_t width, height;
+  unsigned precision = load_JPEG_coefficients(context, &frame, &tables, &width, &height);
+  bool updated[4] = {0};
+  for (uint_fast8_t p = 0; p < frame.count; p ++) {
+    uint_fast8_t table = frame.component_info[p].tableQ;
+    if (updated[table]) continue;
+    updated[table] = true;
+    // the first component's table (i.e., the luminance table for most images) is scaled from the standard's luminance table, and all others are scaled
+    // from its chrominance table; the new table is never allowed to be finer than the current one, since that would only make the file larger
+    uint8_t target[64];
+    calculate_JPEG_quality_table(target, (table == frame.component_info -> tableQ) ? JPEG_luminance_quantization : JPEG_chrominance_quantization, quality);
+    unsigned short previous[64], * quantization = tables.quantization[table];
+    memcpy(previous, quantization, sizeof previous);
+    for (uint_fast8_t coefficient = 0; coefficient < 64; coefficient ++)
+      if (target[coefficient] > quantization[coefficient]) quantization[coefficient] = target[coefficient];
+    for (uint_fast8_t component = p; component < frame.count; component ++) if (frame.component_info[component].tableQ == table)
+      requantize_JPEG_component(&frame, component, previous, quantization, width, height);
+  }
+  generate_transcoded_JPEG_data(context, &frame, tables.quantization, width, height, precision);
+  for (uint_fast8_t p = 0; p < frame.count; p ++) ctxfree(context, frame.component_data[p]);
+}
+
+void requantize_JPEG_component (const struct JPEG_DCT_frame * frame, uint_fast8_t component, const unsigned short * restrict previous,
+                                const unsigned short * restrict current, size_t width, size_t height) {
+  // only the blocks that will be encoded (i.e., not padding blocks) are requantized; coefficients are rounded to the nearest value
+  const struct JPEG_component_info * info = frame -> component_info + component;
+  size_t blockrow = frame -> unitrow * info -> scaleH;
+  size_t blockswide = (width * info -> scaleH - 1) / frame -> maxH / 8 + 1, blockshigh = (height * info -> scaleV - 1) / frame -> maxV / 8 + 1;
+  for (size_t row = 0; row < blockshigh; row ++) for (size_t col = 0; col < blockswide; col ++) {
+    int16_t * block = frame -> component_data[component][row * blockrow + col];
+    for (uint_fast8_t coefficient = 0; coefficient < 64; coefficient ++) if (block[coefficient] && previous[coefficient] != current[coefficient]) {
+      int_fast32_t value = (int_fast32_t) block[coefficient] * previous[coefficient];
+      if (value < 0)
+        block[coefficient] = -((current[coefficient] / 2 - value) / current[coefficient]);
+      else
+        block[coefficient] = (value + current[coefficient] / 2) / current[coefficient];
+    }
+  }
+}
+
+unsigned load_JPEG_coefficients (struct context * context, struct JPEG_DCT_frame * restrict frame, struct JPEG_decoder_tables * restrict tables,
+                                 size_t * restrict width, size_t * restrict height) {
+  // decodes the quantized coefficients of a single-frame JPEG file, without transforming them into pixels; returns the frame's precision
+  // JPEG detection: one or more 0xff bytes followed by 0xd8, as in load_image_buffer_data
+  size_t position;
+  for (position = 0; position < context -> size && context -> data[position] == 0xff; position ++);
+  if (context -> size < 8 || !position || position >= context -> size || context -> data[position] != 0xd8) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  struct JPEG_marker_layout * layout = load_JPEG_marker_layout(context, false);
+  // only single-frame DCT images contain coefficients that can be used directly; hierarchical and lossless images are rejected
+  if (layout -> hierarchical || layout -> frames[1] || (*layout -> frametype & 3) == 3 || (*layout -> frametype & 4))
+    throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  uint32_t components = determine_JPEG_components(context, *layout -> frames);
+  *width = read_be16_unaligned(context -> data + *layout -> frames + 5);
+  *height = get_JPEG_frame_height(context, layout);
+  // higher precisions could generate coefficients (or DC differences) too large for the Huffman encoder
+  unsigned precision = context -> data[*layout -> frames + 2];
+  if (!(*width && *height) || precision < 2 || precision > 12) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  initialize_JPEG_decoder_tables(context, tables, layout);
+  size_t metadata_index = 0;
+  decode_JPEG_DCT_frame(context, layout, components, 0, tables, &metadata_index, precision, *width, *height, false, frame);
+  // the decoder sorts components by ID, but they must be written out in their original order, since some applications rely on that order to determine
+  // their meaning (e.g., for CMYK images)
+  for (uint_fast8_t p = 0; p < frame -> count; p ++) {
+    uint_fast8_t index;
+    for (index = p; frame -> component_info[index].index != context -> data[*layout -> frames + 8 + 3 * p]; index ++);
+    swap(struct JPEG_component_info, frame -> component_info[p], frame -> component_info[index]);
+    int16_t (* data)[64] = frame -> component_data[p];
+    frame -> component_data[p] = frame -> component_data[index];
+    frame -> component_data[index] = data;
+  }
+  return precision;
+}
+
+void generate_transcoded_JPEG_data (struct context * context, const struct JPEG_DCT_frame * frame, unsigned short * const * quantization, size_t width,
+                                    size_t height, unsigned precision) {
+  // switch the context over to output mode (context -> data and context -> output share storage), keeping the input data around for its metadata
+  const unsigned char * data = context -> data;
+  size_t size = context -> size;
+  context -> output = NULL;
+  byteoutput(context, 0xff, 0xd8); // SOI
+  copy_JPEG_metadata_markers(context, data, size);
+  generate_JPEG_coefficient_data(context, frame, quantization, width, height, precision);
+}
+
+void copy_JPEG_metadata_markers (struct context * context, const unsigned char * data, size_t size) {
+  // copies all application (APPn) and comment markers preceding the first frame, so that JFIF, Exif, Adobe and ICC profile data are all preserved
+  size_t offset = 1;
+  while (data[offset ++] == 0xff); // skip the SOI marker
+  while (offset < size && data[offset] == 0xff) {
+    while (offset < size && data[offset] == 0xff) offset ++;
+    if (offset >= size - 2) return;
+    uint_fast8_t marker = data[offset ++];
+    if (marker != 0xc4 && marker != 0xcc && marker != 0xdb && marker != 0xdd && marker != 0xfe && (marker & 0xf0) != 0xe0) return;
+    uint_fast16_t marker_size = read_be16_unaligned(data + offset);
+    if (marker_size < 2 || marker_size > size - offset) return;
+    if (marker == 0xfe || (marker & 0xf0) == 0xe0) {
+      unsigned char * node = append_output_node(context, marker_size + 2);
+      bytewrite(node, 0xff, marker);
+      memcpy(node + 2, data + offset, marker_size);
+    }
+    offset += marker_size;
+  }
+}
+
+void generate_JPEG_coefficient_data (struct context * context, const struct JPEG_DCT_frame * frame, unsigned short * const * quantization,
+                                     size_t width, size_t height, unsigned precision) {
+  // writes out a frame (from the DQT marker to the end of the file) from quantized coefficients, encoding each component in its own sequential scan
+  bool extended = precision != 8, used[4] = {0};
+  for (uint_fast8_t p = 0; p < frame -> count; p ++) used[frame -> component_info[p].tableQ] = true;
+  unsigned char * node = append_output_node(context, 4 + 129 * 4);
+  size_t size = 4;
+  for (uint_fast8_t table = 0; table < 4; table ++) if (used[table]) {
+    uint_fast8_t p;
+    for (p = 0; p < 64 && quantization[table][p] <= 0xff; p ++);
+    if (p < 64) {
+      // 16-bit quantization tables are not allowed in baseline frames
+      extended = true;
+      node[size ++] = 0x10 + table;
+      for (p = 0; p < 64; p ++, size += 2) write_be16_unaligned(node + size, quantization[table][p]);
+    } else {
+      node[size ++] = table;
+      for (p = 0; p < 64; p ++) node[size ++] = quantization[table][p];
+    }
+  }
+  bytewrite(node, 0xff, 0xdb, (size - 2) >> 8, size - 2); // DQT
+  context -> output -> size = size;
+  node = append_output_node(context, 10 + 3 * frame -> count);
+  bytewrite(node, 0xff, extended ? 0xc1 : 0xc0, 0x00, 8 + 3 * frame -> count, precision, height >> 8, height, width >> 8, width, frame -> count); // SOF
+  for (uint_fast8_t p = 0; p < frame -> count; p ++) {
+    const struct JPEG_component_info * info = frame -> component_info + p;
+    bytewrite(node + 10 + 3 * p, info -> index, (info -> scaleH << 4) | info -> scaleV, info -> tableQ);
+  }
+  for (uint_fast8_t p = 0; p < frame -> count; p ++) {
+    const struct JPEG_component_info * info = frame -> component_info + p;
+    size_t count;
+    struct JPEG_encoded_value * data = generate_JPEG_coefficient_data_stream(context, frame -> component_data[p], frame -> unitrow * info -> scaleH,
+                                                                             (width * info -> scaleH - 1) / frame -> maxH / 8 + 1,
+                                                                             (height * info -> scaleV - 1) / frame -> maxV / 8 + 1, &count);
+    // each scan redefines table 0 with the optimal Huffman codes for its own component, so no more than one table of each class is ever needed
+    unsigned char Huffman_table_data[0x200];
+    node = append_output_node(context, 550);
+    size = 4;
+    size += generate_JPEG_Huffman_table(context, data, count, node + size, Huffman_table_data, 0x00);
+    size += generate_JPEG_Huffman_table(context, data, count, node + size, Huffman_table_data + 0x100, 0x10);
+    bytewrite(node, 0xff, 0xc4, (size - 2) >> 8, size - 2); // DHT
+    context -> output -> size = size;
+    byteoutput(context, 0xff, 0xda, 0x00, 0x08, 0x01, info -> index, 0x00, 0x00, 0x3f, 0x00); // SOS, one component, table 0, not progressive
+    encode_JPEG_scan(context, data, count, Huffman_table_data, 0);
+    ctxfree(context, data);
+  }
+  byteoutput(context, 0xff, 0xd9); // EOI
+}
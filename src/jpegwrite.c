@@ -3,70 +3,130 @@
 void generate_JPEG_data (struct context * context) {
   if (context -> source -> frames > 1) throw(context, PLUM_ERR_NO_MULTI_FRAME);
   if (context -> source -> width > 0xffffu || context -> source -> height > 0xffffu) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
+  // images without color only need a luminance component; color images use 4:2:0 chroma subsampling unless the user selects something else
+  bool grayscale = JPEG_image_is_grayscale(context -> source);
+  unsigned char scaleH = 2, scaleV = 2;
+  const struct plum_metadata * restart = plum_find_metadata(context -> source, PLUM_METADATA_JPEG_RESTART_INTERVAL);
+  uint16_t interval = restart ? *(const uint16_t *) restart -> data : 0;
+  const struct plum_metadata * subsampling = plum_find_metadata(context -> source, PLUM_METADATA_JPEG_SUBSAMPLING);
+  if (subsampling) {
+    scaleH = *(const uint8_t *) subsampling -> data;
+    scaleV = 1[(const uint8_t *) subsampling -> data];
+  }
   byteoutput(context,
              0xff, 0xd8, // SOI
-             0xff, 0xe0, 0x00, 0x10, 0x4a, 0x46, 0x49, 0x46, 0x00, 0x01, 0x02, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, // JFIF marker (no thumbnail)
-             0xff, 0xee, 0x00, 0x0e, 0x41, 0x64, 0x6f, 0x62, 0x65, 0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0x01, // Adobe marker (YCbCr colorspace)
-             0xff, 0xc0, 0x00, 0x11, 0x08, // SOF, baseline DCT coding, 8 bits per component...
-             context -> source -> height >> 8, context -> source -> height, context -> source -> width >> 8, context -> source -> width, // dimensions...
-             0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01 // 3 components, component 1 is 4:4:4, table 0, components 2-3 are 4:2:0, table 1
+             0xff, 0xe0, 0x00, 0x10, 0x4a, 0x46, 0x49, 0x46, 0x00, 0x01, 0x02, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00 // JFIF marker (no thumbnail)
             );
+  if (grayscale)
+    byteoutput(context,
+               0xff, 0xc0, 0x00, 0x0b, 0x08, // SOF, baseline DCT coding, 8 bits per component...
+               context -> source -> height >> 8, context -> source -> height, context -> source -> width >> 8, context -> source -> width, // dimensions...
+               0x01, 0x01, 0x11, 0x00 // 1 component, 4:4:4, table 0
+              );
+  else
+    byteoutput(context,
+               0xff, 0xee, 0x00, 0x0e, 0x41, 0x64, 0x6f, 0x62, 0x65, 0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0x01, // Adobe marker (YCbCr colorspace)
+               0xff, 0xc0, 0x00, 0x11, 0x08, // SOF, baseline DCT coding, 8 bits per component...
+               context -> source -> height >> 8, context -> source -> height, context -> source -> width >> 8, context -> source -> width, // dimensions...
+               // 3 components, component 1 has the maximum sampling (scaleH x scaleV), table 0, components 2-3 are subsampled, table 1
+               0x03, 0x01, (scaleH << 4) | scaleV, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01
+              );
   uint8_t luminance_table[64];
   uint8_t chrominance_table[64];
   calculate_JPEG_quantization_tables(context, luminance_table, chrominance_table);
-  unsigned char * node = append_output_node(context, 134);
-  bytewrite(node, 0xff, 0xdb, 0x00, 0x84, 0x00); // DQT, 132 bytes long, table 0 first
+  unsigned char * node = append_output_node(context, grayscale ? 69 : 134);
+  bytewrite(node, 0xff, 0xdb, 0x00, grayscale ? 0x43 : 0x84, 0x00); // DQT, 67 or 132 bytes long, table 0 first
   memcpy(node + 5, luminance_table, sizeof luminance_table);
-  node[69] = 1; // table 1 afterwards
-  memcpy(node + 70, chrominance_table, sizeof chrominance_table);
+  if (!grayscale) {
+    node[69] = 1; // table 1 afterwards
+    memcpy(node + 70, chrominance_table, sizeof chrominance_table);
+  }
   size_t unitsH = (context -> image -> width + 7) / 8, unitsV = (context -> image -> height + 7) / 8, units = unitsH * unitsV;
   double (* luminance)[64] = ctxmalloc(context, units * sizeof *luminance);
-  double (* blue_chrominance)[64] = ctxmalloc(context, units * sizeof *blue_chrominance);
-  double (* red_chrominance)[64] = ctxmalloc(context, units * sizeof *red_chrominance);
-  convert_JPEG_components_to_YCbCr(context, luminance, blue_chrominance, red_chrominance);
-  size_t reduced_units = ((unitsH + 1) >> 1) * ((unitsV + 1) >> 1);
-  double (* buffer)[64] = ctxmalloc(context, reduced_units * sizeof *buffer);
-  subsample_JPEG_component(blue_chrominance, buffer, unitsH, unitsV);
-  ctxfree(context, blue_chrominance);
-  blue_chrominance = buffer;
-  buffer = ctxmalloc(context, reduced_units * sizeof *buffer);
-  subsample_JPEG_component(red_chrominance, buffer, unitsH, unitsV);
-  ctxfree(context, red_chrominance);
-  red_chrominance = buffer;
-  size_t luminance_count, chrominance_count;
-  // do chrominance first, since it will generally use less memory, so the chrominance data can be freed afterwards to reduce overall memory usage
-  struct JPEG_encoded_value * chrominance_data = generate_JPEG_chrominance_data_stream(context, blue_chrominance, red_chrominance, reduced_units,
-                                                                                       chrominance_table, &chrominance_count);
-  ctxfree(context, red_chrominance);
-  ctxfree(context, blue_chrominance);
-  struct JPEG_encoded_value * luminance_data = generate_JPEG_luminance_data_stream(context, luminance, units, luminance_table, &luminance_count);
+  struct JPEG_encoded_value * chrominance_data = NULL;
+  size_t luminance_count, chrominance_count = 0;
+  if (grayscale)
+    convert_JPEG_components_to_YCbCr(context, luminance, NULL, NULL);
+  else {
+    double (* blue_chrominance)[64] = ctxmalloc(context, units * sizeof *blue_chrominance);
+    double (* red_chrominance)[64] = ctxmalloc(context, units * sizeof *red_chrominance);
+    convert_JPEG_components_to_YCbCr(context, luminance, blue_chrominance, red_chrominance);
+    size_t reduced_units = units;
+    if (scaleH > 1 || scaleV > 1) {
+      reduced_units = ((unitsH + scaleH - 1) / scaleH) * ((unitsV + scaleV - 1) / scaleV);
+      double (* buffer)[64] = ctxmalloc(context, reduced_units * sizeof *buffer);
+      subsample_JPEG_component(blue_chrominance, buffer, unitsH, unitsV, scaleH, scaleV);
+      ctxfree(context, blue_chrominance);
+      blue_chrominance = buffer;
+      buffer = ctxmalloc(context, reduced_units * sizeof *buffer);
+      subsample_JPEG_component(red_chrominance, buffer, unitsH, unitsV, scaleH, scaleV);
+      ctxfree(context, red_chrominance);
+      red_chrominance = buffer;
+    }
+    // do chrominance first, since it will generally use less memory, so the chrominance data can be freed afterwards to reduce overall memory usage
+    chrominance_data = generate_JPEG_chrominance_data_stream(context, blue_chrominance, red_chrominance, reduced_units, interval, chrominance_table,
+                                                             &chrominance_count);
+    ctxfree(context, red_chrominance);
+    ctxfree(context, blue_chrominance);
+  }
+  struct JPEG_encoded_value * luminance_data = generate_JPEG_luminance_data_stream(context, luminance, units, interval, luminance_table, &luminance_count);
   ctxfree(context, luminance);
   unsigned char Huffman_table_data[0x400]; // luminance DC, AC, chrominance DC, AC
   node = append_output_node(context, 1096);
   size_t size = 4;
   size += generate_JPEG_Huffman_table(context, luminance_data, luminance_count, node + size, Huffman_table_data, 0x00);
   size += generate_JPEG_Huffman_table(context, luminance_data, luminance_count, node + size, Huffman_table_data + 0x100, 0x10);
-  size += generate_JPEG_Huffman_table(context, chrominance_data, chrominance_count, node + size, Huffman_table_data + 0x200, 0x01);
-  size += generate_JPEG_Huffman_table(context, chrominance_data, chrominance_count, node + size, Huffman_table_data + 0x300, 0x11);
+  if (!grayscale) {
+    size += generate_JPEG_Huffman_table(context, chrominance_data, chrominance_count, node + size, Huffman_table_data + 0x200, 0x01);
+    size += generate_JPEG_Huffman_table(context, chrominance_data, chrominance_count, node + size, Huffman_table_data + 0x300, 0x11);
+  }
   bytewrite(node, 0xff, 0xc4, (size - 2) >> 8, size - 2); // DHT
   context -> output -> size = size;
+  // the restart interval is measured in MCUs, which contain a single unit in the luminance scan and one unit per component in the chrominance scan
+  if (interval) byteoutput(context, 0xff, 0xdd, 0x00, 0x04, interval >> 8, interval); // DRI
   byteoutput(context, 0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00); // SOS, component 1, table 0, not progressive
-  encode_JPEG_scan(context, luminance_data, luminance_count, Huffman_table_data);
+  encode_JPEG_scan(context, luminance_data, luminance_count, Huffman_table_data, interval);
   ctxfree(context, luminance_data);
-  byteoutput(context, 0xff, 0xda, 0x00, 0x0a, 0x02, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00); // SOS, components 2-3, table 1, not progressive
-  encode_JPEG_scan(context, chrominance_data, chrominance_count, Huffman_table_data + 0x200);
-  ctxfree(context, chrominance_data);
+  if (!grayscale) {
+    byteoutput(context, 0xff, 0xda, 0x00, 0x0a, 0x02, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00); // SOS, components 2-3, table 1, not progressive
+    encode_JPEG_scan(context, chrominance_data, chrominance_count, Huffman_table_data + 0x200, 2 * interval);
+    ctxfree(context, chrominance_data);
+  }
   byteoutput(context, 0xff, 0xd9); // EOI
 }
 
+bool JPEG_image_is_grayscale (const struct plum_image * image) {
+  // the encoder only uses 8 bits per component, so colors only need to be gray up to that precision; if the image has a palette, only check the palette
+  size_t remaining = image -> palette ? image -> max_palette_index + 1 : ((size_t) image -> width * image -> height * image -> frames), offset = 0;
+  const uint8_t * colors = image -> palette ? image -> palette : image -> data;
+  uint64_t buffer[0x100];
+  while (remaining) {
+    size_t count = (remaining > 0x100) ? 0x100 : remaining;
+    plum_convert_colors(buffer, colors + plum_color_buffer_size(offset, image -> color_format), count, PLUM_COLOR_64, image -> color_format);
+    for (size_t p = 0; p < count; p ++) if (((buffer[p] ^ (buffer[p] >> 16)) | (buffer[p] ^ (buffer[p] >> 32))) & 0xff00u) return false;
+    offset += count;
+    remaining -= count;
+  }
+  return true;
+}
+
 void calculate_JPEG_quantization_tables (struct context * context, uint8_t luminance_table[restrict static 64], uint8_t chrominance_table[restrict static 64]) {
-  // start with the standard's tables (reduced by 1, since that will be added back later)
-  static const uint8_t luminance_base[64] =   { 15,  10,  11,  13,  11,   9,  15,  13,  12,  13,  17,  16,  15,  18,  23,  39,  25,  23,  21,  21,  23,
-                                                48,  34,  36,  28,  39,  57,  50,  60,  59,  56,  50,  55,  54,  63,  71,  91,  77,  63,  67,  86,  68,
-                                                54,  55,  79, 108,  80,  86,  94,  97, 102, 103, 102,  61,  76, 112, 120, 111,  99, 119,  91, 100, 102,  98};
-  static const uint8_t chrominance_base[64] = { 16,  17,  17,  23,  20,  23,  46,  25,  25,  46,  98,  65,  55,  65,  98,  98,  98,  98,  98,  98,  98,
-                                                98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,
-                                                98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98,  98};
+  // if the user selected a quality or custom tables, use them instead of automatically selecting a quality
+  const struct plum_metadata * metadata = plum_find_metadata(context -> source, PLUM_METADATA_JPEG_QUALITY);
+  if (metadata) {
+    const uint8_t * data = metadata -> data;
+    if (metadata -> size == 1) {
+      calculate_JPEG_quality_table(luminance_table, JPEG_luminance_quantization, *data);
+      calculate_JPEG_quality_table(chrominance_table, JPEG_chrominance_quantization, *data);
+    } else
+      // custom tables are given in natural (row-major) order
+      for (uint_fast8_t p = 0; p < 64; p ++) {
+        uint_fast8_t index = JPEG_zigzag_rows[p] * 8 + JPEG_zigzag_columns[p];
+        luminance_table[p] = data[index];
+        chrominance_table[p] = data[64 + index];
+      }
+    return;
+  }
   // compute a score based on the logarithm of the image's dimensions (approximated using integer math)
   uint_fast32_t current, score = 0;
   for (current = context -> source -> width; current > 4; current >>= 1) score += 2;
@@ -79,12 +139,24 @@ void calculate_JPEG_quantization_tables (struct context * context, uint8_t lumin
   uint_fast32_t adjustment = 72 - (depth & 0xff) - ((depth >> 8) & 0xff) - ((depth >> 16) & 0xff);
   // compute the final quantization coefficients based on the scores above
   for (uint_fast8_t p = 0; p < 64; p ++) {
-    luminance_table[p] = 1 + luminance_base[p] * score / 25;
-    chrominance_table[p] = 1 + chrominance_base[p] * score * adjustment / 1200;
+    // the standard's tables are reduced by 1 here, since that 1 is added back afterwards
+    luminance_table[p] = 1 + (JPEG_luminance_quantization[p] - 1) * score / 25;
+    chrominance_table[p] = 1 + (JPEG_chrominance_quantization[p] - 1) * score * adjustment / 1200;
+  }
+}
+
+void calculate_JPEG_quality_table (uint8_t table[restrict static 64], const uint8_t base[restrict static 64], unsigned quality) {
+  // scales one of the standard's tables (base) for a quality between 1 and 100, like most encoders do: quality 50 uses the table as is, higher qualities
+  // scale it down linearly (to all ones at quality 100) and lower qualities scale it up hyperbolically
+  uint_fast32_t scale = (quality < 50) ? 5000 / quality : 200 - 2 * quality;
+  for (uint_fast8_t p = 0; p < 64; p ++) {
+    uint_fast32_t value = (base[p] * scale + 50) / 100;
+    table[p] = value ? (value > 0xff) ? 0xff : value : 1;
   }
 }
 
 void convert_JPEG_components_to_YCbCr (struct context * context, double (* restrict luminance)[64], double (* restrict blue)[64], double (* restrict red)[64]) {
+  // blue and red may be null (for grayscale images), in which case only the luminance is computed
   const unsigned char * data = context -> source -> data;
   size_t offset = context -> source -> palette ? 1 : plum_color_buffer_size(1, context -> source -> color_format), rowoffset = offset * context -> source -> width;
   double palette_luminance[256];
@@ -93,26 +165,34 @@ void convert_JPEG_components_to_YCbCr (struct context * context, double (* restr
   uint64_t * buffer = ctxmalloc(context, sizeof *buffer * ((context -> source -> palette && context -> source -> max_palette_index > 7) ?
                                                            context -> source -> max_palette_index + 1 : 8));
   // define macros to reduce repetition within the function
-  #define nextunit luminance ++, blue ++, red ++
+  #define nextunit do {         \
+    luminance ++;               \
+    if (blue) blue ++, red ++;  \
+  } while (false)
   #define convertblock(rows, cols) do                                                                                                                          \
     if (context -> source -> palette)                                                                                                                          \
       for (uint_fast8_t row = 0; row < (rows); row ++) for (uint_fast8_t col = 0; col < (cols); col ++) {                                                      \
         unsigned char index = data[(unitrow * 8 + row) * context -> source -> width + unitcol * 8 + col], coord = row * 8 + col;                               \
         coord[*luminance] = palette_luminance[index];                                                                                                          \
-        coord[*blue] = palette_blue[index];                                                                                                                    \
-        coord[*red] = palette_red[index];                                                                                                                      \
+        if (blue) {                                                                                                                                            \
+          coord[*blue] = palette_blue[index];                                                                                                                  \
+          coord[*red] = palette_red[index];                                                                                                                    \
+        }                                                                                                                                                      \
       }                                                                                                                                                        \
     else {                                                                                                                                                     \
       size_t index = unitrow * 8 * rowoffset + unitcol * 8 * offset;                                                                                           \
       for (uint_fast8_t row = 0; row < (rows); row ++, index += rowoffset)                                                                                     \
-        convert_JPEG_colors_to_YCbCr(data + index, cols, context -> source -> color_format, *luminance + 8 * row, *blue + 8 * row, *red + 8 * row, buffer);    \
+        convert_JPEG_colors_to_YCbCr(data + index, cols, context -> source -> color_format, *luminance + 8 * row, blue ? *blue + 8 * row : NULL,                \
+                                     red ? *red + 8 * row : NULL, buffer);                                                                                     \
     }                                                                                                                                                          \
   while (false)
   #define copyvalues(index, offset) do {                     \
     uint_fast8_t coord = (index), ref = coord - (offset);    \
     coord[*luminance] = ref[*luminance];                     \
-    coord[*blue] = ref[*blue];                               \
-    coord[*red] = ref[*red];                                 \
+    if (blue) {                                              \
+      coord[*blue] = ref[*blue];                             \
+      coord[*red] = ref[*red];                               \
+    }                                                        \
   } while (false)
   // actually do the conversion
   if (context -> source -> palette)
@@ -151,59 +231,35 @@ void convert_JPEG_components_to_YCbCr (struct context * context, double (* restr
 
 void convert_JPEG_colors_to_YCbCr (const void * restrict colors, size_t count, unsigned char flags, double * restrict luminance, double * restrict blue,
                                    double * restrict red, uint64_t * restrict buffer) {
+  // blue and red may be null, in which case only the luminance is computed
   plum_convert_colors(buffer, colors, count, PLUM_COLOR_64, flags);
   for (size_t p = 0; p < count; p ++) {
     double R = (double) (buffer[p] & 0xffffu) / 257.0, G = (double) ((buffer[p] >> 16) & 0xffffu) / 257.0, B = (double) ((buffer[p] >> 32) & 0xffffu) / 257.0;
     luminance[p] = 0x0.4c8b4395810628p+0 * R + 0x0.9645a1cac08310p+0 * G + 0x0.1d2f1a9fbe76c8p+0 * B - 128.0;
-    blue[p] = 0.5 * (B - 1.0) - 0x0.2b32468049f7e8p+0 * R - 0x0.54cdb97fb60818p+0 * G;
-    red[p] = 0.5 * (R - 1.0) - 0x0.6b2f1c1ead19ecp+0 * G - 0x0.14d0e3e152e614p+0 * B;
+    if (blue) {
+      blue[p] = 0.5 * (B - 1.0) - 0x0.2b32468049f7e8p+0 * R - 0x0.54cdb97fb60818p+0 * G;
+      red[p] = 0.5 * (R - 1.0) - 0x0.6b2f1c1ead19ecp+0 * G - 0x0.14d0e3e152e614p+0 * B;
+    }
   }
 }
 
-void subsample_JPEG_component (double (* restrict component)[64], double (* restrict output)[64], size_t unitsH, size_t unitsV) {
-  #define reduce(offset, shift, y, x) do {                                              \
-    uint_fast8_t index = (y) * 8 + (x);                                                 \
-    const double * ref = component[(offset) * unitsH] + (index * 2 - 64 * (offset));    \
-    (*output)[index + (shift)] = (*ref + ref[1] + ref[8] + ref[9]) * 0.25;              \
-  } while (false)
-  for (size_t unitrow = 0; unitrow < (unitsV >> 1); unitrow ++) {
-    for (size_t unitcol = 0; unitcol < (unitsH >> 1); unitcol ++) {
-      for (uint_fast8_t p = 0; p < 8; p += 4) {
-        for (uint_fast8_t row = 0; row < 4; row ++) for (uint_fast8_t col = 0; col < 4; col ++) {
-          reduce(0, p, row, col);
-          reduce(1, p, row + 4, col);
-        }
-        component ++;
-      }
-      output ++;
-    }
-    if (unitsH & 1) {
-      for (uint_fast8_t row = 0; row < 4; row ++) for (uint_fast8_t col = 0; col < 4; col ++) {
-        reduce(0, 0, row, col);
-        reduce(1, 0, row + 4, col);
-      }
-      component ++;
-      for (uint_fast8_t row = 0; row < 8; row ++) for (uint_fast8_t col = 4; col < 8; col ++) (*output)[row * 8 + col] = (*output)[row * 8 + col - 1];
-      output ++;
-    }
-    component += unitsH; // skip odd rows
-  }
-  if (unitsV & 1) {
-    for (size_t unitcol = 0; unitcol < (unitsH >> 1); unitcol ++) {
-      for (uint_fast8_t p = 0; p < 8; p += 4) {
-        for (uint_fast8_t row = 0; row < 4; row ++) for (uint_fast8_t col = 0; col < 4; col ++) reduce(0, p, row, col);
-        component ++;
-      }
-      for (uint_fast8_t p = 32; p < 64; p ++) (*output)[p] = (*output)[p - 8];
-      output ++;
-    }
-    if (unitsH & 1) {
-      for (uint_fast8_t row = 0; row < 4; row ++) for (uint_fast8_t col = 0; col < 4; col ++) {
-        reduce(0, 0, row, col);
-        (*output)[row * 8 + col + 4] = (*output)[row * 8 + col];
+void subsample_JPEG_component (double (* restrict component)[64], double (* restrict output)[64], size_t unitsH, size_t unitsV, unsigned char scaleH,
+                               unsigned char scaleV) {
+  // averages groups of scaleH x scaleV values (each scale being 1 or 2); output units that extend past the right or bottom edges of the component repeat
+  // the component's last column or row of values
+  size_t width = unitsH * 8, height = unitsV * 8;
+  double factor = 1.0 / (scaleH * scaleV);
+  for (size_t top = 0; top < height; top += 8 * scaleV) for (size_t left = 0; left < width; left += 8 * scaleH) {
+    for (uint_fast8_t row = 0; row < 8; row ++) for (uint_fast8_t col = 0; col < 8; col ++) {
+      double sum = 0.0;
+      for (uint_fast8_t y = 0; y < scaleV; y ++) for (uint_fast8_t x = 0; x < scaleH; x ++) {
+        size_t sourcerow = top + row * scaleV + y, sourcecol = left + col * scaleH + x;
+        if (sourcerow >= height) sourcerow = height - 1;
+        if (sourcecol >= width) sourcecol = width - 1;
+        sum += component[(sourcerow >> 3) * unitsH + (sourcecol >> 3)][(sourcerow & 7) * 8 + (sourcecol & 7)];
       }
-      for (uint_fast8_t p = 32; p < 64; p ++) (*output)[p] = (*output)[p - 8];
+      (*output)[row * 8 + col] = sum * factor;
     }
+    output ++;
   }
-  #undef reduce
 }
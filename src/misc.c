@@ -37,7 +37,43 @@ unsigned plum_validate_image (const struct plum_image * image) {
           if (right < rectangles[frame].left || right > image -> width || bottom < rectangles[frame].top || bottom > image -> height)
             return PLUM_ERR_INVALID_METADATA;
         }
-      }
+      } break;
+      case PLUM_METADATA_PNG_DATA: {
+        const struct PNG_retained_data * retained = metadata -> data;
+        if (metadata -> size < sizeof *retained || retained -> frames > (metadata -> size - sizeof *retained) / sizeof *retained -> sizes)
+          return PLUM_ERR_INVALID_METADATA;
+        if (retained -> imagetype > 6 || retained -> imagetype == 1 || retained -> imagetype == 5 || retained -> interlaced > 1 ||
+            !retained -> bitdepth || (retained -> bitdepth & (retained -> bitdepth - 1)) || retained -> bitdepth > 16 ||
+            retained -> palette_size % 3 || retained -> palette_size > 0x300 || retained -> transparency_size > 0x100)
+          return PLUM_ERR_INVALID_METADATA;
+        // the remaining data must be exactly as large as the sizes indicate
+        size_t remaining = metadata -> size - sizeof *retained - sizeof *retained -> sizes * retained -> frames;
+        if (remaining < retained -> palette_size + retained -> transparency_size) return PLUM_ERR_INVALID_METADATA;
+        remaining -= retained -> palette_size + retained -> transparency_size;
+        for (uint_fast32_t frame = 0; frame < retained -> frames; frame ++) {
+          if (retained -> sizes[frame] > remaining) return PLUM_ERR_INVALID_METADATA;
+          remaining -= retained -> sizes[frame];
+        }
+        if (remaining) return PLUM_ERR_INVALID_METADATA;
+      } break;
+      case PLUM_METADATA_JPEG_QUALITY:
+        // either a single quality value (1-100) or two custom quantization tables, none of whose values can be zero
+        if (metadata -> size == 1) {
+          if (!*(const uint8_t *) metadata -> data || *(const uint8_t *) metadata -> data > 100) return PLUM_ERR_INVALID_METADATA;
+        } else if (metadata -> size == 128) {
+          if (memchr(metadata -> data, 0, metadata -> size)) return PLUM_ERR_INVALID_METADATA;
+        } else
+          return PLUM_ERR_INVALID_METADATA;
+        break;
+      case PLUM_METADATA_JPEG_SUBSAMPLING:
+        if (metadata -> size != 2) return PLUM_ERR_INVALID_METADATA;
+        for (uint_fast8_t p = 0; p < 2; p ++) if (p[(const uint8_t *) metadata -> data] - 1u > 1) return PLUM_ERR_INVALID_METADATA;
+        break;
+      case PLUM_METADATA_JPEG_RESTART_INTERVAL:
+        if (metadata -> size != sizeof(uint16_t)) return PLUM_ERR_INVALID_METADATA;
+        break;
+      case PLUM_METADATA_PNG_REDUCTION:
+        if (metadata -> size != 1) return PLUM_ERR_INVALID_METADATA;
     }
   }
   return 0;
@@ -8,6 +8,10 @@ static inline uint32_t read_le32_unaligned (const unsigned char * data) {
   return (uint32_t) *data | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
 }
 
+static inline uint64_t read_le64_unaligned (const unsigned char * data) {
+  return (uint64_t) read_le32_unaligned(data) | ((uint64_t) read_le32_unaligned(data + 4) << 32);
+}
+
 static inline uint16_t read_be16_unaligned (const unsigned char * data) {
   return (uint16_t) data[1] | ((uint16_t) *data << 8);
 }
@@ -24,6 +28,10 @@ static inline void write_le32_unaligned (unsigned char * restrict buffer, uint32
   bytewrite(buffer, value, value >> 8, value >> 16, value >> 24);
 }
 
+static inline void write_le64_unaligned (unsigned char * restrict buffer, uint64_t value) {
+  bytewrite(buffer, value, value >> 8, value >> 16, value >> 24, value >> 32, value >> 40, value >> 48, value >> 56);
+}
+
 static inline void write_be16_unaligned (unsigned char * restrict buffer, uint32_t value) {
   bytewrite(buffer, value >> 8, value);
 }
@@ -2,30 +2,36 @@
 
 #define PNG_MAX_LOOKBACK_COUNT 64
 
-unsigned char * compress_PNG_data (struct context * context, const unsigned char * restrict data, size_t size, size_t extra, size_t * restrict output_size) {
-  // extra is the number of zero bytes inserted before the compressed data; they are not included in the size
-  unsigned char * output = ctxmalloc(context, extra + 8); // two bytes extra to handle leftover bits in dataword
-  memset(output, 0, extra);
-  size_t inoffset = 0, outoffset = extra + byteappend(output + extra, 0x78, 0x5e);
+void compress_PNG_data (struct context * context, const unsigned char * restrict data, size_t size, struct PNG_chunk_output * restrict output) {
+  // the compressed data is written directly into output chunks as it is generated
+  append_PNG_chunk_output(context, output, (const unsigned char []) {0x78, 0x5e}, 2);
+  size_t inoffset = 0;
   uint16_t * references = ctxmalloc(context, sizeof *references * 0x8000u * PNG_MAX_LOOKBACK_COUNT);
   for (size_t p = 0; p < (size_t) 0x8000u * PNG_MAX_LOOKBACK_COUNT; p ++) references[p] = 0xffffu;
   uint32_t dataword = 0;
   uint8_t bits = 0;
   bool force = false;
+  unsigned char header[8];
   while (inoffset < size) {
     size_t blocksize, count;
     struct compressed_PNG_code * compressed = generate_compressed_PNG_block(context, data, inoffset, size, references, &blocksize, &count, force);
     force = false;
     if (compressed) {
       inoffset += blocksize;
-      if (inoffset == size) dataword |= 1u << bits;
-      bits ++;
-      unsigned char * compressed_data = emit_PNG_compressed_block(context, compressed, count, count >= 16, &blocksize, &dataword, &bits);
-      if (SIZE_MAX - outoffset < blocksize + 6) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
-      output = ctxrealloc(context, output, outoffset + blocksize + 6);
-      memcpy(output + outoffset, compressed_data, blocksize);
-      ctxfree(context, compressed_data);
-      outoffset += blocksize;
+      // split the codes into as many blocks as needed so that each block gets a tree that matches its own statistics
+      size_t current = 0;
+      do {
+        bool custom_tree;
+        size_t blockcount = select_PNG_block_split(context, compressed + current, count - current, &custom_tree);
+        current += blockcount;
+        if (inoffset == size && current == count) dataword |= 1u << bits;
+        bits ++;
+        unsigned char * compressed_data = emit_PNG_compressed_block(context, compressed + current - blockcount, blockcount, custom_tree, &blocksize,
+                                                                    &dataword, &bits);
+        append_PNG_chunk_output(context, output, compressed_data, blocksize);
+        ctxfree(context, compressed_data);
+      } while (current < count);
+      ctxfree(context, compressed);
     }
     if (inoffset >= size) break;
     blocksize = compute_uncompressed_PNG_block_size(data, inoffset, size, references);
@@ -33,30 +39,29 @@ unsigned char * compress_PNG_data (struct context * context, const unsigned char
       if (blocksize > 0xffffu) blocksize = 0xffffu;
       if (inoffset + blocksize == size) dataword |= 1u << bits;
       bits += 3;
+      size_t headersize = 0;
       while (bits) {
-        output[outoffset ++] = dataword;
+        header[headersize ++] = dataword;
         dataword >>= 8;
         bits = (bits >= 8) ? bits - 8 : 0;
       }
-      if (SIZE_MAX - outoffset < blocksize + 10) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
-      output = ctxrealloc(context, output, outoffset + blocksize + 10);
-      write_le16_unaligned(output + outoffset, blocksize);
-      write_le16_unaligned(output + outoffset + 2, 0xffffu - blocksize);
-      memcpy(output + outoffset + 4, data + inoffset, blocksize);
-      outoffset += blocksize + 4;
+      write_le16_unaligned(header + headersize, blocksize);
+      write_le16_unaligned(header + headersize + 2, 0xffffu - blocksize);
+      append_PNG_chunk_output(context, output, header, headersize + 4);
+      append_PNG_chunk_output(context, output, data + inoffset, blocksize);
       inoffset += blocksize;
     } else
       force = true;
   }
   ctxfree(context, references);
+  size_t headersize = 0;
   while (bits) {
-    output[outoffset ++] = dataword;
+    header[headersize ++] = dataword;
     dataword >>= 8;
     bits = (bits >= 8) ? bits - 8 : 0;
   }
-  write_be32_unaligned(output + outoffset, compute_Adler32_checksum(data, size));
-  *output_size = outoffset + 4 - extra;
-  return output;
+  write_be32_unaligned(header + headersize, compute_Adler32_checksum(data, size));
+  append_PNG_chunk_output(context, output, header, headersize + 4);
 }
 
 struct compressed_PNG_code * generate_compressed_PNG_block (struct context * context, const unsigned char * restrict data, size_t offset, size_t size,
@@ -178,6 +183,86 @@ void emit_PNG_code (struct context * context, struct compressed_PNG_code ** code
   (*codes)[(*count) ++] = result;
 }
 
+#define PNG_BLOCK_SPLIT_WINDOW 0x400
+
+size_t select_PNG_block_split (struct context * context, const struct compressed_PNG_code * restrict codes, size_t count, bool * restrict custom_tree) {
+  // extends the block one window of codes at a time, and ends it when emitting the next window as a new block (with its own tree) costs less
+  size_t codecounts[0x120] = {[0x100] = 1};
+  size_t distcounts[0x20] = {0};
+  size_t current = (count > PNG_BLOCK_SPLIT_WINDOW) ? PNG_BLOCK_SPLIT_WINDOW : count;
+  count_PNG_codes(codes, current, codecounts, distcounts);
+  size_t cost = compute_PNG_block_cost(context, codecounts, distcounts, custom_tree);
+  while (current < count) {
+    // merge a short trailing window into the one before it, since it would rarely pay for its own tree
+    size_t next = (count - current >= 2 * PNG_BLOCK_SPLIT_WINDOW) ? current + PNG_BLOCK_SPLIT_WINDOW : count;
+    size_t windowcounts[0x120] = {[0x100] = 1};
+    size_t windowdists[0x20] = {0};
+    count_PNG_codes(codes + current, next - current, windowcounts, windowdists);
+    bool window_tree, merged_tree;
+    size_t windowcost = compute_PNG_block_cost(context, windowcounts, windowdists, &window_tree);
+    for (uint_fast16_t p = 0; p < 0x120; p ++) if (p != 0x100) windowcounts[p] += codecounts[p];
+    for (uint_fast8_t p = 0; p < 0x20; p ++) windowdists[p] += distcounts[p];
+    size_t mergedcost = compute_PNG_block_cost(context, windowcounts, windowdists, &merged_tree);
+    // the split block costs three extra bits for its own block header
+    if (cost + windowcost + 3 < mergedcost) break;
+    memcpy(codecounts, windowcounts, sizeof codecounts);
+    memcpy(distcounts, windowdists, sizeof distcounts);
+    cost = mergedcost;
+    *custom_tree = merged_tree;
+    current = next;
+  }
+  return current;
+}
+
+#undef PNG_BLOCK_SPLIT_WINDOW
+
+size_t compute_PNG_block_cost (struct context * context, const size_t codecounts[restrict static 0x120], const size_t distcounts[restrict static 0x20],
+                               bool * restrict custom_tree) {
+  // estimates the size in bits of a block's contents (after the block header), selecting whichever of the fixed and custom trees is smaller
+  unsigned char lengths[0x140];
+  generate_Huffman_tree(context, codecounts, lengths, 0x120, 15);
+  generate_Huffman_tree(context, distcounts, lengths + 0x120, 0x20, 15);
+  size_t fixedcost = 0, customcost = 0;
+  for (uint_fast16_t p = 0; p < 0x11e; p ++) {
+    uint_fast8_t extra = (p >= 0x109 && p < 0x11d) ? (p - 0x105) >> 2 : 0;
+    fixedcost += codecounts[p] * (default_PNG_Huffman_table_lengths[p] + extra);
+    customcost += codecounts[p] * (lengths[p] + extra);
+  }
+  for (uint_fast8_t p = 0; p < 30; p ++) {
+    uint_fast8_t extra = (p >= 4) ? (p - 2) >> 1 : 0;
+    fixedcost += distcounts[p] * (default_PNG_Huffman_table_lengths[p + 0x120] + extra);
+    customcost += distcounts[p] * (lengths[p + 0x120] + extra);
+  }
+  // a custom tree must also pay for its own description, which is computed exactly as generate_PNG_Huffman_trees would emit it
+  unsigned char encoded[0x140];
+  unsigned char encodedlengths[19];
+  unsigned maxcode, maxdist, repcount;
+  unsigned encodedlength = encode_PNG_tree_lengths(lengths, lengths + 0x120, encoded, &maxcode, &maxdist);
+  size_t encodedcounts[19] = {0};
+  for (uint_fast16_t p = 0; p < encodedlength; p ++) {
+    encodedcounts[encoded[p]] ++;
+    if (encoded[p] >= 16) {
+      // 16, 17, 18 are followed by 2, 3, 7 bits of repeat count
+      customcost += (2 << (encoded[p] - 16)) - (encoded[p] > 16);
+      p ++;
+    }
+  }
+  generate_Huffman_tree(context, encodedcounts, encodedlengths, 19, 7);
+  for (repcount = 18; repcount > 3 && !encodedlengths[compressed_PNG_code_table_order[repcount]]; repcount --);
+  customcost += 14 + 3 * (repcount + 1);
+  for (uint_fast8_t p = 0; p < 19; p ++) customcost += encodedcounts[p] * encodedlengths[p];
+  *custom_tree = customcost < fixedcost;
+  return *custom_tree ? customcost : fixedcost;
+}
+
+void count_PNG_codes (const struct compressed_PNG_code * restrict codes, size_t count, size_t codecounts[restrict static 0x120],
+                      size_t distcounts[restrict static 0x20]) {
+  for (size_t p = 0; p < count; p ++) {
+    codecounts[codes[p].datacode] ++;
+    if (codes[p].datacode > 0x100) distcounts[codes[p].distcode] ++;
+  }
+}
+
 unsigned char * emit_PNG_compressed_block (struct context * context, const struct compressed_PNG_code * restrict codes, size_t count, bool custom_tree,
                                            size_t * restrict blocksize, uint32_t * restrict dataword, uint8_t * restrict bits) {
   // emit the code identifying whether the block is compressed with a fixed or custom tree
@@ -186,10 +271,7 @@ unsigned char * emit_PNG_compressed_block (struct context * context, const struc
   // count up the frequency of each code; this will be used to generate a custom tree (if needed) and to precalculate the output size
   size_t codecounts[0x120] = {[0x100] = 1}; // other entries will be zero-initialized
   size_t distcounts[0x20] = {0};
-  for (size_t p = 0; p < count; p ++) {
-    codecounts[codes[p].datacode] ++;
-    if (codes[p].datacode > 0x100) distcounts[codes[p].distcode] ++;
-  }
+  count_PNG_codes(codes, count, codecounts, distcounts);
   unsigned char * output = NULL;
   *blocksize = 0;
   // ensure that we have the proper tree: use the documented tree if fixed, or generate (and output) a custom tree if custom
@@ -261,35 +343,10 @@ unsigned char * generate_PNG_Huffman_trees (struct context * context, uint32_t *
   // also outputs the tree length data to the output stream and returns it
   generate_Huffman_tree(context, codecounts, codelengths, 0x120, 15);
   generate_Huffman_tree(context, distcounts, distlengths, 0x20, 15);
-  unsigned char lengths[0x140];
+  unsigned char lengths[19];
   unsigned char encoded[0x140];
-  unsigned repcount, maxcode, maxdist, encodedlength = 0, code = 0;
-  for (maxcode = 0x11f; !codelengths[maxcode]; maxcode --);
-  for (maxdist = 0x1f; maxdist && !distlengths[maxdist]; maxdist --);
-  memcpy(lengths, codelengths, maxcode + 1);
-  memcpy(lengths + maxcode + 1, distlengths, maxdist + 1);
-  while (code < maxcode + maxdist + 2)
-    if (!lengths[code]) {
-      for (repcount = 1; repcount < 0x8a && code + repcount < maxcode + maxdist + 2 && !lengths[code + repcount]; repcount ++);
-      if (repcount < 3) {
-        encoded[encodedlength ++] = 0;
-        code ++;
-      } else {
-        code += repcount;
-        encoded[encodedlength ++] = 17 + (repcount > 10);
-        encoded[encodedlength ++] = repcount - ((repcount >= 11) ? 11 : 3);
-      }
-    } else if (code && lengths[code] == lengths[code - 1]) {
-      for (repcount = 1; repcount < 6 && code + repcount < maxcode + maxdist + 2 && lengths[code + repcount] == lengths[code - 1]; repcount ++);
-      if (repcount < 3)
-        encoded[encodedlength ++] = lengths[code ++];
-      else {
-        encoded[encodedlength ++] = 16;
-        encoded[encodedlength ++] = repcount - 3;
-        code += repcount;
-      }
-    } else
-      encoded[encodedlength ++] = lengths[code ++];
+  unsigned repcount, maxcode, maxdist;
+  unsigned encodedlength = encode_PNG_tree_lengths(codelengths, distlengths, encoded, &maxcode, &maxdist);
   size_t encodedcounts[19] = {0};
   for (uint_fast16_t p = 0; p < encodedlength; p ++) {
     encodedcounts[encoded[p]] ++;
@@ -328,3 +385,37 @@ unsigned char * generate_PNG_Huffman_trees (struct context * context, uint32_t *
   *size = current - result;
   return result;
 }
+
+unsigned encode_PNG_tree_lengths (const unsigned char codelengths[restrict static 0x120], const unsigned char distlengths[restrict static 0x20],
+                                  unsigned char encoded[restrict static 0x140], unsigned * restrict maxcode, unsigned * restrict maxdist) {
+  // run-length encodes the lengths of both trees as they are stored in the block header; repeat codes are followed by their repeat counts
+  unsigned char lengths[0x140];
+  unsigned repcount, encodedlength = 0, code = 0;
+  for (*maxcode = 0x11f; !codelengths[*maxcode]; -- *maxcode);
+  for (*maxdist = 0x1f; *maxdist && !distlengths[*maxdist]; -- *maxdist);
+  memcpy(lengths, codelengths, *maxcode + 1);
+  memcpy(lengths + *maxcode + 1, distlengths, *maxdist + 1);
+  while (code < *maxcode + *maxdist + 2)
+    if (!lengths[code]) {
+      for (repcount = 1; repcount < 0x8a && code + repcount < *maxcode + *maxdist + 2 && !lengths[code + repcount]; repcount ++);
+      if (repcount < 3) {
+        encoded[encodedlength ++] = 0;
+        code ++;
+      } else {
+        code += repcount;
+        encoded[encodedlength ++] = 17 + (repcount > 10);
+        encoded[encodedlength ++] = repcount - ((repcount >= 11) ? 11 : 3);
+      }
+    } else if (code && lengths[code] == lengths[code - 1]) {
+      for (repcount = 1; repcount < 6 && code + repcount < *maxcode + *maxdist + 2 && lengths[code + repcount] == lengths[code - 1]; repcount ++);
+      if (repcount < 3)
+        encoded[encodedlength ++] = lengths[code ++];
+      else {
+        encoded[encodedlength ++] = 16;
+        encoded[encodedlength ++] = repcount - 3;
+        code += repcount;
+      }
+    } else
+      encoded[encodedlength ++] = lengths[code ++];
+  return encodedlength;
+}
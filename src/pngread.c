@@ -45,7 +45,10 @@ void load_PNG_data (struct context * context, unsigned flags, size_t limit) {
   // allocate space for the image data and load the main image; for a PNG file, we're done here
   allocate_framebuffers(context, flags, context -> image -> palette);
   load_PNG_frame(context, chunks -> data, 0, palette, max_palette_index, imagetype, bitdepth, interlaced, background, transparent);
-  if (!chunks -> animation) return;
+  if (!chunks -> animation) {
+    if (flags & PLUM_PNG_DATA_RETAIN) add_PNG_retained_data_metadata(context, chunks);
+    return;
+  }
   // load the animation control chunk and duration and disposal metadata
   uint32_t loops = read_be32_unaligned(context -> data + chunks -> animation + 4);
   if (loops > 0x7fffffffu) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
@@ -120,6 +123,8 @@ void load_PNG_data (struct context * context, unsigned flags, size_t limit) {
   }
   if (replace_last || (*chunks -> frameinfo >= *chunks -> data && *disposals >= PLUM_DISPOSAL_REPLACE))
     disposals[context -> image -> frames - 1] += PLUM_DISPOSAL_REPLACE;
+  // reduced frames are composited when loaded, so their compressed data cannot be reused
+  if ((flags & PLUM_PNG_DATA_RETAIN) && !check_PNG_reduced_frames(context, chunks)) add_PNG_retained_data_metadata(context, chunks);
   // we're done; a few things will be leaked here (chunk data, palette data...), but they are small and will be collected later
 }
 
@@ -353,7 +358,7 @@ uint64_t add_PNG_background_metadata (struct context * context, const struct PNG
   switch (imagetype) {
     case 0: case 4:
       if (read_be32_unaligned(data - 8) != 2) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-      color = read_le16_unaligned(data);
+      color = read_be16_unaligned(data);
       if (color >> bitdepth) return 0;
       color = 0x100010001u * (uint64_t) bitextend16(color, bitdepth);
       break;
@@ -413,3 +418,63 @@ bool load_PNG_animation_frame_metadata (struct context * context, size_t offset,
     *duration = 1;
   return !blend;
 }
+
+void add_PNG_retained_data_metadata (struct context * context, const struct PNG_chunk_locations * chunks) {
+  // keeps a copy of the compressed data (and the chunks needed to interpret it), so it can be emitted as is if the image is stored unchanged
+  struct PNG_retained_data * retained;
+  uint_fast32_t frames = context -> image -> frames;
+  if (frames > (SIZE_MAX - sizeof *retained) / sizeof *retained -> sizes) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
+  size_t palette_size = chunks -> palette ? read_be32_unaligned(context -> data + chunks -> palette - 8) : 0;
+  size_t transparency_size = chunks -> transparency ? read_be32_unaligned(context -> data + chunks -> transparency - 8) : 0;
+  size_t size = sizeof *retained + sizeof *retained -> sizes * frames + palette_size + transparency_size;
+  // if the first fcTL chunk comes before the IDAT chunks, the first frame is part of the animation and its fdAT list is empty
+  const size_t * const * framedata = (const size_t * const *) chunks -> framedata;
+  if (framedata && *chunks -> frameinfo < *chunks -> data) framedata ++;
+  for (uint_fast32_t frame = 0; frame < frames; frame ++) {
+    size_t current = frame ? get_PNG_frame_data_size(context, framedata[frame - 1], 4) : get_PNG_frame_data_size(context, chunks -> data, 0);
+    if (SIZE_MAX - size < current) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
+    size += current;
+  }
+  struct plum_metadata * metadata = plum_allocate_metadata(context -> image, size);
+  if (!metadata) throw(context, PLUM_ERR_OUT_OF_MEMORY);
+  retained = metadata -> data;
+  *retained = (struct PNG_retained_data) {
+    .frames = frames,
+    .palette_size = palette_size,
+    .transparency_size = transparency_size,
+    .bitdepth = context -> data[24],
+    .imagetype = context -> data[25],
+    .interlaced = context -> data[28]
+  };
+  unsigned char * current = (unsigned char *) (retained -> sizes + frames);
+  if (palette_size) memcpy(current, context -> data + chunks -> palette, palette_size);
+  current += palette_size;
+  if (transparency_size) memcpy(current, context -> data + chunks -> transparency, transparency_size);
+  current += transparency_size;
+  for (uint_fast32_t frame = 0; frame < frames; frame ++) {
+    const size_t * chunk = frame ? framedata[frame - 1] : chunks -> data;
+    size_t offset = frame ? 4 : 0;
+    retained -> sizes[frame] = 0;
+    for (; *chunk; chunk ++) {
+      size_t chunksize = read_be32_unaligned(context -> data + *chunk - 8) - offset;
+      memcpy(current, context -> data + *chunk + offset, chunksize);
+      current += chunksize;
+      retained -> sizes[frame] += chunksize;
+    }
+  }
+  // the hash only depends on the image's colors, so later palette processing (like removing or sorting the palette) doesn't invalidate it
+  retained -> hash = compute_image_color_hash(context, context -> image);
+  metadata -> type = PLUM_METADATA_PNG_DATA;
+  metadata -> next = context -> image -> metadata;
+  context -> image -> metadata = metadata;
+}
+
+size_t get_PNG_frame_data_size (struct context * context, const size_t * chunks, size_t offset) {
+  size_t result = 0;
+  for (; *chunks; chunks ++) {
+    size_t current = read_be32_unaligned(context -> data + *chunks - 8) - offset;
+    if (SIZE_MAX - result < current) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
+    result += current;
+  }
+  return result;
+}
@@ -162,27 +162,15 @@ void load_PNG_raw_frame_pass (struct context * context, unsigned char * restrict
 }
 
 void expand_bitpacked_PNG_data (unsigned char * restrict result, const unsigned char * restrict source, size_t count, uint8_t bitdepth) {
+  // for 1 and 2 bits per pixel, expand a whole byte at once: the multiplication places shifted copies of the byte so that each pixel lands at the top
+  // of its own output byte (without carries between copies), and then all pixels are shifted and masked together
   switch (bitdepth) {
     case 1:
-      for (; count > 7; count -= 8) {
-        *(result ++) = !!(*source & 0x80);
-        *(result ++) = !!(*source & 0x40);
-        *(result ++) = !!(*source & 0x20);
-        *(result ++) = !!(*source & 0x10);
-        *(result ++) = !!(*source & 8);
-        *(result ++) = !!(*source & 4);
-        *(result ++) = !!(*source & 2);
-        *(result ++) = *(source ++) & 1;
-      }
+      for (; count > 7; count -= 8, result += 8) write_le64_unaligned(result, ((uint64_t) *(source ++) * 0x8040201008040201u >> 7) & 0x101010101010101u);
       if (count) for (unsigned char remainder = *source; count; count --, remainder <<= 1) *(result ++) = remainder >> 7;
       break;
     case 2:
-      for (; count > 3; count -= 4) {
-        *(result ++) = *source >> 6;
-        *(result ++) = (*source >> 4) & 3;
-        *(result ++) = (*source >> 2) & 3;
-        *(result ++) = *(source ++) & 3;
-      }
+      for (; count > 3; count -= 4, result += 4) write_le32_unaligned(result, ((uint64_t) *(source ++) * 0x40100401u >> 6) & 0x3030303u);
       if (count) for (unsigned char remainder = *source; count; count --, remainder <<= 2) *(result ++) = remainder >> 6;
       break;
     case 4:
@@ -1,16 +1,37 @@
 #include "proto.h"
 
+#define PNG_OUTPUT_CHUNK_SIZE 0x10000u
+
 void generate_PNG_data (struct context * context) {
   if (context -> source -> frames > 1) throw(context, PLUM_ERR_NO_MULTI_FRAME);
-  unsigned type = generate_PNG_header(context, NULL);
-  append_PNG_image_data(context, context -> source -> data, type, NULL, NULL);
+  const struct PNG_retained_data * retained = get_PNG_retained_data(context);
+  if (retained) {
+    append_PNG_retained_header(context, retained);
+    struct PNG_chunk_output output = {.chunkID = NULL};
+    append_PNG_chunk_output(context, &output, (const unsigned char *) (retained -> sizes + 1) + retained -> palette_size + retained -> transparency_size,
+                            *retained -> sizes);
+    finish_PNG_chunk_output(context, &output);
+  } else {
+    unsigned type = generate_PNG_header(context, NULL);
+    append_PNG_image_data(context, context -> source -> data, type, NULL, NULL);
+  }
   output_PNG_chunk(context, 0x49454e44u, 0, NULL); // IEND
 }
 
 void generate_APNG_data (struct context * context) {
   if (context -> source -> frames > 0x40000000u) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
-  struct plum_rectangle * boundaries = get_frame_boundaries(context, false);
-  unsigned type = generate_PNG_header(context, boundaries);
+  // if the original compressed data can be reused, all frames are full size (since reduced frames are never retained)
+  const struct PNG_retained_data * retained = get_PNG_retained_data(context);
+  const unsigned char * retained_frame = NULL;
+  struct plum_rectangle * boundaries = NULL;
+  unsigned type = 0;
+  if (retained) {
+    append_PNG_retained_header(context, retained);
+    retained_frame = (const unsigned char *) (retained -> sizes + retained -> frames) + retained -> palette_size + retained -> transparency_size;
+  } else {
+    boundaries = get_frame_boundaries(context, false);
+    type = generate_PNG_header(context, boundaries);
+  }
   uint32_t loops = 1;
   const struct plum_metadata * metadata = plum_find_metadata(context -> source, PLUM_METADATA_LOOP_COUNT);
   if (metadata) {
@@ -43,7 +64,13 @@ void generate_APNG_data (struct context * context) {
     write_be32_unaligned(animation_data, context -> source -> frames - 1);
     output_PNG_chunk(context, 0x6163544cu, sizeof animation_data, animation_data); // acTL
   }
-  append_PNG_image_data(context, context -> source -> data, type, NULL, NULL);
+  if (retained) {
+    struct PNG_chunk_output output = {.chunkID = NULL};
+    append_PNG_chunk_output(context, &output, retained_frame, *retained -> sizes);
+    finish_PNG_chunk_output(context, &output);
+    retained_frame += *retained -> sizes;
+  } else
+    append_PNG_image_data(context, context -> source -> data, type, NULL, NULL);
   size_t framesize = (size_t) context -> source -> width * context -> source -> height;
   if (!context -> source -> palette) framesize = plum_color_buffer_size(framesize, context -> source -> color_format);
   for (uint_fast32_t frame = 1; frame < context -> source -> frames; frame ++) {
@@ -51,15 +78,24 @@ void generate_APNG_data (struct context * context) {
     uint_fast8_t disposal = (disposal_count > frame) ? disposals[frame] : 0;
     append_APNG_frame_header(context, (duration_count > frame) ? durations[frame] : 0, disposal, last_disposal, &chunkID, &duration_remainder, rectangle);
     last_disposal = disposal;
-    append_PNG_image_data(context, context -> source -> data8 + framesize * frame, type, &chunkID, rectangle);
+    if (retained) {
+      struct PNG_chunk_output output = {.chunkID = &chunkID};
+      append_PNG_chunk_output(context, &output, retained_frame, retained -> sizes[frame]);
+      finish_PNG_chunk_output(context, &output);
+      retained_frame += retained -> sizes[frame];
+    } else
+      append_PNG_image_data(context, context -> source -> data8 + framesize * frame, type, &chunkID, rectangle);
   }
   ctxfree(context, boundaries);
   output_PNG_chunk(context, 0x49454e44u, 0, NULL); // IEND
 }
 
 unsigned generate_PNG_header (struct context * context, struct plum_rectangle * restrict boundaries) {
-  // returns the selected type of image: 0, 1, 2, 3: paletted (1 << type bits), 4, 5: 8-bit RGB (without and with alpha), 6, 7: 16-bit RGB
+  // returns the selected type of image: 0, 1, 2, 3: paletted (1 << type bits), 4, 5: 8-bit RGB (without and with alpha), 6, 7: 16-bit RGB,
+  // 8, 9: 8-bit grayscale (without and with alpha), 10, 11: 16-bit grayscale
   // also updates the frame boundaries for APNG images (ensuring that frame 0 and frames with nonempty pixels outside their boundaries become full size)
+  // if the user requested it, images without a palette may be replaced (in context -> source) by an equivalent image with a generated palette if that is
+  // smaller, and they may be stored as grayscale or with fewer bits per channel if that is lossless
   byteoutput(context, 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a);
   bool transparency;
   if (boundaries) {
@@ -70,6 +106,18 @@ unsigned generate_PNG_header (struct context * context, struct plum_rectangle *
     transparency = image_has_transparency(context -> source);
   uint32_t depth = get_color_depth(context -> source);
   if (!transparency) depth &= 0xffffffu;
+  bool grayscale = false;
+  const struct plum_metadata * reduction = plum_find_metadata(context -> source, PLUM_METADATA_PNG_REDUCTION);
+  if (!context -> source -> palette && reduction && *(const uint8_t *) reduction -> data) {
+    uint_fast8_t reductions = check_PNG_color_reductions(context, transparency);
+    if (reductions & 4)
+      for (uint_fast8_t p = 0; p < 32; p += 8) if (((depth >> p) & 0xff) > 8) depth = (depth & ~((uint32_t) 0xff << p)) | ((uint32_t) 8 << p);
+    if (bit_depth_less_than(depth, 0x8080808u)) {
+      grayscale = reductions & 1;
+      generate_PNG_reduced_palette(context, 8 * ((grayscale ? 1 : 3) + transparency), transparency);
+    } else
+      grayscale = reductions & 2;
+  }
   uint_fast8_t type;
   if (context -> source -> palette)
     if (context -> source -> max_palette_index < 2)
@@ -80,6 +128,8 @@ unsigned generate_PNG_header (struct context * context, struct plum_rectangle *
       type = 2;
     else
       type = 3;
+  else if (grayscale)
+    type = bit_depth_less_than(depth, 0x8080808u) ? 8 + transparency : 10 + transparency;
   else if (bit_depth_less_than(depth, 0x8080808u))
     type = 4 + transparency;
   else
@@ -96,8 +146,11 @@ void append_PNG_header_chunks (struct context * context, unsigned type, uint32_t
   unsigned char header[13];
   write_be32_unaligned(header, context -> image -> width);
   write_be32_unaligned(header + 4, context -> image -> height);
-  header[8] = (type < 4) ? 1 << type : (8 << (type >= 6));
-  header[9] = (type >= 4) ? 2 + 4 * (type & 1) : 3;
+  header[8] = (type < 4) ? 1 << type : (8 << ((type >> 1) & 1));
+  if (type < 4)
+    header[9] = 3;
+  else
+    header[9] = ((type < 8) ? 2 : 0) + 4 * (type & 1);
   bytewrite(header + 10, 0, 0, 0);
   output_PNG_chunk(context, 0x49484452u, sizeof header, header); // IHDR
   unsigned char depthdata[4];
@@ -107,7 +160,86 @@ void append_PNG_header_chunks (struct context * context, unsigned type, uint32_t
     if (depthdata[1] > 8) depthdata[1] = 8;
     if (depthdata[2] > 8) depthdata[2] = 8;
   }
-  output_PNG_chunk(context, 0x73424954u, 3 + ((type & 5) == 5), depthdata); // sBIT
+  if (type >= 8) {
+    // grayscale images only have a gray and an alpha depth; use the largest color channel depth for gray
+    if (depthdata[1] > *depthdata) *depthdata = depthdata[1];
+    if (depthdata[2] > *depthdata) *depthdata = depthdata[2];
+    depthdata[1] = depthdata[3];
+    output_PNG_chunk(context, 0x73424954u, 1 + (type & 1), depthdata); // sBIT
+  } else
+    output_PNG_chunk(context, 0x73424954u, 3 + ((type & 5) == 5), depthdata); // sBIT
+}
+
+uint_fast8_t check_PNG_color_reductions (struct context * context, bool transparency) {
+  // checks all pixels (and the background color, since it must be representable too) in a single pass; returns a bitmask of reductions:
+  // 1: grayscale when using 8 bits per channel, 2: grayscale when using 16 bits per channel, 4: all used channels fit in 8 bits without loss
+  size_t remaining = (size_t) context -> source -> width * context -> source -> height * context -> source -> frames, offset = 0;
+  uint64_t * buffer = ctxmalloc(context, sizeof *buffer * 0x1000);
+  uint_fast8_t result = 7;
+  // the exactness check only applies to channels in use, and it is only relevant if some channel is deeper than 8 bits
+  uint64_t channels = transparency ? 0xffffffffffffffffu : 0xffffffffffffu;
+  if (bit_depth_less_than(get_color_depth(context -> source), 0x8080808u)) result &= ~4;
+  const struct plum_metadata * background = plum_find_metadata(context -> source, PLUM_METADATA_BACKGROUND);
+  if (background) {
+    plum_convert_colors(buffer, background -> data, 1, PLUM_COLOR_64, context -> source -> color_format);
+    result &= check_PNG_color_reductions_for_pixels(buffer, 1, channels);
+  }
+  while (result && remaining) {
+    size_t count = (remaining > 0x1000) ? 0x1000 : remaining;
+    plum_convert_colors(buffer, context -> source -> data8 + plum_color_buffer_size(offset, context -> source -> color_format), count, PLUM_COLOR_64,
+                        context -> source -> color_format);
+    result &= check_PNG_color_reductions_for_pixels(buffer, count, channels);
+    offset += count;
+    remaining -= count;
+  }
+  ctxfree(context, buffer);
+  return result;
+}
+
+uint_fast8_t check_PNG_color_reductions_for_pixels (const uint64_t * restrict pixels, size_t count, uint64_t channels) {
+  uint64_t graymismatch = 0, exactmismatch = 0;
+  for (size_t p = 0; p < count; p ++) {
+    graymismatch |= (pixels[p] ^ (pixels[p] >> 16)) | (pixels[p] ^ (pixels[p] >> 32));
+    exactmismatch |= (pixels[p] ^ (pixels[p] >> 8)) & channels;
+  }
+  return !(graymismatch & 0xff00u) | (!(graymismatch & 0xffffu) << 1) | (!(exactmismatch & 0xff00ff00ff00ffu) << 2);
+}
+
+void generate_PNG_reduced_palette (struct context * context, unsigned bits, bool transparency) {
+  // replaces the source image with an equivalent one using a palette if the image has at most 256 colors and the palette is expected to make it smaller
+  // than storing its pixels directly using bits bits per pixel (the original image is unchanged)
+  size_t count = (size_t) context -> source -> width * context -> source -> height * context -> source -> frames;
+  uint8_t * indexes = ctxmalloc(context, count);
+  void * palette = ctxmalloc(context, plum_color_buffer_size(0x100, context -> source -> color_format));
+  int result = plum_convert_colors_to_indexes(indexes, context -> source -> data, palette, count, context -> source -> color_format);
+  if (result < 0 && result != -PLUM_ERR_TOO_MANY_COLORS) throw(context, -result);
+  // estimate the savings from the uncompressed size of the pixel data, assuming that compression shrinks it to about a quarter of that size: the smaller
+  // rows must pay for the PLTE (and possibly tRNS) chunks, which is what keeps tiny images from using a palette
+  bool smaller = false;
+  if (result >= 0) {
+    unsigned palette_bits = (result < 2) ? 1 : (result < 4) ? 2 : (result < 16) ? 4 : 8;
+    size_t rows = (size_t) context -> source -> height * context -> source -> frames, width = context -> source -> width;
+    size_t savings = rows * (((width * bits + 7) >> 3) - ((width * palette_bits + 7) >> 3)) / 4;
+    smaller = savings > 12 + 3 * (result + 1) + (transparency ? 12 + (result + 1) : 0);
+  }
+  if (smaller) {
+    // the background color must remain representable, since indexed images can only reference it by palette index
+    const struct plum_metadata * background = plum_find_metadata(context -> source, PLUM_METADATA_BACKGROUND);
+    bool found = !background;
+    size_t size = plum_color_buffer_size(1, context -> source -> color_format);
+    for (int index = 0; !found && index <= result; index ++) found = !memcmp((const unsigned char *) palette + size * index, background -> data, size);
+    if (found) {
+      struct plum_image * image = ctxmalloc(context, sizeof *image);
+      *image = *context -> source;
+      image -> data8 = indexes;
+      image -> palette = palette;
+      image -> max_palette_index = result;
+      context -> source = image;
+      return;
+    }
+  }
+  ctxfree(context, palette);
+  ctxfree(context, indexes);
 }
 
 void append_PNG_palette_data (struct context * context, bool use_alpha) {
@@ -130,11 +262,12 @@ void append_PNG_background_chunk (struct context * context, const void * restric
     unsigned char chunkdata[6];
     uint64_t color;
     plum_convert_colors(&color, data, 1, PLUM_COLOR_64, context -> source -> color_format);
-    if (type < 6) color = (color >> 8) & 0xff00ff00ffu;
+    if (!(type & 2)) color = (color >> 8) & 0xff00ff00ffu;
     write_be16_unaligned(chunkdata, color);
     write_be16_unaligned(chunkdata + 2, color >> 16);
     write_be16_unaligned(chunkdata + 4, color >> 32);
-    output_PNG_chunk(context, 0x624b4744u, sizeof chunkdata, chunkdata); // bKGD
+    // grayscale images store a single gray value (the background color is known to be gray for them)
+    output_PNG_chunk(context, 0x624b4744u, (type >= 8) ? 2 : sizeof chunkdata, chunkdata); // bKGD
   } else {
     size_t size = plum_color_buffer_size(1, context -> source -> color_format);
     const unsigned char * current = context -> source -> palette;
@@ -149,35 +282,12 @@ void append_PNG_background_chunk (struct context * context, const void * restric
 void append_PNG_image_data (struct context * context, const void * restrict data, unsigned type, uint32_t * restrict chunkID,
                             const struct plum_rectangle * boundaries) {
   // chunkID counts animation data chunks (fcTL, fdAT); if chunkID is null, emit IDAT chunks instead
-  size_t raw, size;
+  size_t raw;
   unsigned char * uncompressed = generate_PNG_frame_data(context, data, type, &raw, boundaries);
-  // if chunkID is non-null, compress_PNG_data will insert four bytes of padding before the compressed data so this function can write a chunk ID there
-  unsigned char * compressed = compress_PNG_data(context, uncompressed, raw, chunkID ? 4 : 0, &size);
+  struct PNG_chunk_output output = {.chunkID = chunkID};
+  compress_PNG_data(context, uncompressed, raw, &output);
   ctxfree(context, uncompressed);
-  unsigned char * current = compressed;
-  if (chunkID) {
-    current += 4;
-    while (size > 0x7ffffffbu) {
-      if (*chunkID > 0x7fffffffu) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
-      write_be32_unaligned(current - 4, (*chunkID) ++);
-      output_PNG_chunk(context, 0x66644154u, 0x7ffffffcu, current - 4); // fdAT
-      current += 0x7ffffff8u;
-      size -= 0x7ffffff8u;
-    }
-    if (size) {
-      if (*chunkID > 0x7fffffffu) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
-      write_be32_unaligned(current - 4, (*chunkID) ++);
-      output_PNG_chunk(context, 0x66644154u, size + 4, current - 4); // fdAT
-    }
-  } else {
-    while (size > 0x7fffffffu) {
-      output_PNG_chunk(context, 0x49444154u, 0x7ffffffcu, current); // IDAT
-      current += 0x7ffffffcu;
-      size -= 0x7ffffffcu;
-    }
-    if (size) output_PNG_chunk(context, 0x49444154u, size, current); // IDAT
-  }
-  ctxfree(context, compressed);
+  finish_PNG_chunk_output(context, &output);
 }
 
 void append_APNG_frame_header (struct context * context, uint64_t duration, uint8_t disposal, uint8_t previous, uint32_t * restrict chunkID,
@@ -226,6 +336,103 @@ void output_PNG_chunk (struct context * context, uint32_t type, uint32_t size, c
   write_be32_unaligned(node + size + 8, compute_PNG_CRC(node + 4, size + 4));
 }
 
+void append_PNG_chunk_output (struct context * context, struct PNG_chunk_output * restrict output, const unsigned char * restrict data, size_t size) {
+  while (size) {
+    if (!output -> chunk) {
+      // start a new chunk with room for its full size; the length and the CRC are written when the chunk is finished
+      output -> chunk = append_output_node(context, PNG_OUTPUT_CHUNK_SIZE + 12);
+      if (output -> chunkID) {
+        if (*output -> chunkID > 0x7fffffffu) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
+        write_be32_unaligned(output -> chunk + 4, 0x66644154u); // fdAT
+        write_be32_unaligned(output -> chunk + 8, (*output -> chunkID) ++);
+        output -> size = 4;
+      } else {
+        write_be32_unaligned(output -> chunk + 4, 0x49444154u); // IDAT
+        output -> size = 0;
+      }
+      output -> crc = update_PNG_CRC(0, output -> chunk + 4, output -> size + 4);
+    }
+    size_t count = PNG_OUTPUT_CHUNK_SIZE - output -> size;
+    if (count > size) count = size;
+    memcpy(output -> chunk + 8 + output -> size, data, count);
+    output -> crc = update_PNG_CRC(output -> crc, data, count);
+    output -> size += count;
+    data += count;
+    size -= count;
+    if (output -> size == PNG_OUTPUT_CHUNK_SIZE) finish_PNG_chunk_output(context, output);
+  }
+}
+
+void finish_PNG_chunk_output (struct context * context, struct PNG_chunk_output * restrict output) {
+  // the chunk being finished is always the last output node, since no other output is generated while a chunk is in progress
+  if (!output -> chunk) return;
+  write_be32_unaligned(output -> chunk, output -> size);
+  write_be32_unaligned(output -> chunk + 8 + output -> size, output -> crc);
+  context -> output -> size = output -> size + 12;
+  output -> chunk = NULL;
+}
+
+const struct PNG_retained_data * get_PNG_retained_data (struct context * context) {
+  // returns the original compressed data retained when the image was loaded, but only if the image's pixels haven't changed since then
+  const struct plum_metadata * metadata = plum_find_metadata(context -> source, PLUM_METADATA_PNG_DATA);
+  if (!metadata) return NULL;
+  const struct PNG_retained_data * retained = metadata -> data;
+  if (retained -> frames != context -> source -> frames || retained -> hash != compute_image_color_hash(context, context -> source)) return NULL;
+  return retained;
+}
+
+void append_PNG_retained_header (struct context * context, const struct PNG_retained_data * retained) {
+  // like generate_PNG_header, but reproducing the original image's format, since the retained data can only be decoded with it
+  byteoutput(context, 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a);
+  unsigned char header[13];
+  write_be32_unaligned(header, context -> source -> width);
+  write_be32_unaligned(header + 4, context -> source -> height);
+  bytewrite(header + 8, retained -> bitdepth, retained -> imagetype, 0, 0, retained -> interlaced);
+  output_PNG_chunk(context, 0x49484452u, sizeof header, header); // IHDR
+  // sBIT values cannot exceed the sample depth, which is always 8 for indexed images; grayscale images only store the gray and alpha depths
+  uint_fast8_t maxdepth = (retained -> imagetype == 3) ? 8 : retained -> bitdepth;
+  uint32_t depth = get_color_depth(context -> source);
+  unsigned char depthdata[4];
+  for (uint_fast8_t p = 0; p < 4; p ++) {
+    depthdata[p] = depth >> (8 * p);
+    if (depthdata[p] > maxdepth) depthdata[p] = maxdepth;
+  }
+  if (retained -> imagetype & 2)
+    output_PNG_chunk(context, 0x73424954u, 3 + (retained -> imagetype == 6), depthdata); // sBIT
+  else {
+    depthdata[1] = depthdata[3];
+    output_PNG_chunk(context, 0x73424954u, 1 + (retained -> imagetype == 4), depthdata); // sBIT
+  }
+  const unsigned char * data = (const unsigned char *) (retained -> sizes + retained -> frames);
+  if (retained -> palette_size) output_PNG_chunk(context, 0x504c5445u, retained -> palette_size, data); // PLTE
+  if (retained -> transparency_size) output_PNG_chunk(context, 0x74524e53u, retained -> transparency_size, data + retained -> palette_size); // tRNS
+  const struct plum_metadata * background = plum_find_metadata(context -> source, PLUM_METADATA_BACKGROUND);
+  if (background) append_PNG_retained_background_chunk(context, retained, background -> data);
+}
+
+void append_PNG_retained_background_chunk (struct context * context, const struct PNG_retained_data * retained, const void * restrict data) {
+  uint64_t color;
+  plum_convert_colors(&color, data, 1, PLUM_COLOR_64, context -> source -> color_format);
+  unsigned char chunkdata[6];
+  if (retained -> imagetype == 3) {
+    // like append_PNG_background_chunk, omit the chunk if the color isn't part of the palette
+    const unsigned char * palette = (const unsigned char *) (retained -> sizes + retained -> frames);
+    for (uint_fast16_t index = 0; index < retained -> palette_size / 3; index ++)
+      if (bytematch(palette + index * 3, color >> 8, color >> 24, color >> 40)) {
+        *chunkdata = index;
+        output_PNG_chunk(context, 0x624b4744u, 1, chunkdata); // bKGD
+        return;
+      }
+    return;
+  }
+  uint_fast8_t shift = 16 - retained -> bitdepth;
+  write_be16_unaligned(chunkdata, (color & 0xffffu) >> shift);
+  write_be16_unaligned(chunkdata + 2, ((color >> 16) & 0xffffu) >> shift);
+  write_be16_unaligned(chunkdata + 4, ((color >> 32) & 0xffffu) >> shift);
+  // grayscale images only store a single gray value, taken from the red channel
+  output_PNG_chunk(context, 0x624b4744u, (retained -> imagetype & 2) ? 6 : 2, chunkdata); // bKGD
+}
+
 unsigned char * generate_PNG_frame_data (struct context * context, const void * restrict data, unsigned type, size_t * restrict size,
                                          const struct plum_rectangle * boundaries) {
   struct plum_rectangle framearea;
@@ -261,6 +468,11 @@ void generate_PNG_row_data (struct context * context, const void * restrict data
   switch (type) {
     case 0: case 1: case 2: {
       const unsigned char * indexes = data;
+      // pack 8 (or 4) pixels at once: the multiplication moves each pixel's bits into their final position in the top byte without carries
+      if (!type)
+        for (; width > 7; width -= 8, indexes += 8) *(output ++) = read_le64_unaligned(indexes) * 0x8040201008040201u >> 56;
+      else if (type == 1)
+        for (; width > 3; width -= 4, indexes += 4) *(output ++) = (uint32_t) (read_le32_unaligned(indexes) * 0x40100401u) >> 24;
       uint_fast8_t dataword = 0, bits = 0, pixelbits = 1 << type;
       for (uint_fast32_t p = 0; p < width; p ++) {
         dataword = (dataword << pixelbits) | *(indexes ++);
@@ -275,25 +487,33 @@ void generate_PNG_row_data (struct context * context, const void * restrict data
     case 3:
       memcpy(output, data, width);
       break;
-    case 4: case 5: {
+    case 4: case 5: case 8: case 9: {
       uint32_t * pixels = ctxmalloc(context, sizeof *pixels * width);
       plum_convert_colors(pixels, data, width, PLUM_COLOR_32 | PLUM_ALPHA_INVERT, context -> source -> color_format);
       if (type == 5)
         for (uint_fast32_t p = 0; p < width; p ++) write_le32_unaligned(output + 4 * p, pixels[p]);
-      else
+      else if (type == 4)
         for (uint_fast32_t p = 0; p < width; p ++) output += byteappend(output, pixels[p], pixels[p] >> 8, pixels[p] >> 16);
+      else if (type == 9)
+        for (uint_fast32_t p = 0; p < width; p ++) output += byteappend(output, pixels[p], pixels[p] >> 24);
+      else
+        for (uint_fast32_t p = 0; p < width; p ++) output[p] = pixels[p];
       ctxfree(context, pixels);
     } break;
-    case 6: case 7: {
+    case 6: case 7: case 10: case 11: {
       uint64_t * pixels = ctxmalloc(context, sizeof *pixels * width);
       plum_convert_colors(pixels, data, width, PLUM_COLOR_64 | PLUM_ALPHA_INVERT, context -> source -> color_format);
       if (type == 7)
         for (uint_fast32_t p = 0; p < width; p ++)
           output += byteappend(output, pixels[p] >> 8, pixels[p], pixels[p] >> 24, pixels[p] >> 16, pixels[p] >> 40, pixels[p] >> 32,
                                pixels[p] >> 56, pixels[p] >> 48);
-      else
+      else if (type == 6)
         for (uint_fast32_t p = 0; p < width; p ++)
           output += byteappend(output, pixels[p] >> 8, pixels[p], pixels[p] >> 24, pixels[p] >> 16, pixels[p] >> 40, pixels[p] >> 32);
+      else if (type == 11)
+        for (uint_fast32_t p = 0; p < width; p ++) output += byteappend(output, pixels[p] >> 8, pixels[p], pixels[p] >> 56, pixels[p] >> 48);
+      else
+        for (uint_fast32_t p = 0; p < width; p ++) output += byteappend(output, pixels[p] >> 8, pixels[p]);
       ctxfree(context, pixels);
     }
   }
@@ -51,7 +51,9 @@ internal void generate_BMP_RGB_data(struct context *, unsigned char *);
 
 // checksum.c
 internal uint32_t compute_PNG_CRC(const unsigned char *, size_t);
+internal uint32_t update_PNG_CRC(uint32_t, const unsigned char *, size_t);
 internal uint32_t compute_Adler32_checksum(const unsigned char *, size_t);
+internal uint64_t compute_image_color_hash(struct context *, const struct plum_image *);
 
 // color.c
 internal bool image_has_transparency(const struct plum_image *);
@@ -137,36 +139,61 @@ internal bool next_JPEG_arithmetic_bit(struct context *, size_t * restrict, size
 internal uint32_t determine_JPEG_components(struct context *, size_t);
 internal unsigned get_JPEG_component_count(uint32_t);
 internal void (* get_JPEG_component_transfer_function(struct context *, const struct JPEG_marker_layout *, uint32_t))
+               (uint64_t * restrict, size_t, unsigned, const float **);
+internal void append_JPEG_color_depth_metadata(struct context *, void (*) (uint64_t * restrict, size_t, unsigned, const float **), unsigned);
+internal void (* get_JPEG_double_transfer_function(void (*) (uint64_t * restrict, size_t, unsigned, const float **)))
                (uint64_t * restrict, size_t, unsigned, const double **);
-internal void append_JPEG_color_depth_metadata(struct context *, void (*) (uint64_t * restrict, size_t, unsigned, const double **), unsigned);
-internal void JPEG_transfer_RGB(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_BGR(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_ABGR(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_grayscale(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_alpha_grayscale(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_YCbCr(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_CbYCr(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_YCbCrK(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_CbKYCr(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_ACbYCr(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_CMYK(uint64_t * restrict, size_t, unsigned, const double **);
-internal void JPEG_transfer_CKMY(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_RGB_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_BGR_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_ABGR_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_grayscale_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_alpha_grayscale_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_YCbCr_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_CbYCr_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_YCbCrK_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_CbKYCr_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_ACbYCr_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_CMYK_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_CKMY_float(uint64_t * restrict, size_t, unsigned, const float **);
+internal void JPEG_transfer_RGB_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_BGR_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_ABGR_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_grayscale_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_alpha_grayscale_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_YCbCr_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_CbYCr_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_YCbCrK_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_CbKYCr_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_ACbYCr_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_CMYK_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void JPEG_transfer_CKMY_double(uint64_t * restrict, size_t, unsigned, const double **);
+internal void write_JPEG_YCbCr_strip(struct context *, float * const *, const size_t * restrict, size_t, size_t, unsigned char, unsigned char, float,
+                                     unsigned, unsigned, unsigned, float * restrict, uint64_t * restrict);
 
 // jpegcompress.c
-internal struct JPEG_encoded_value * generate_JPEG_luminance_data_stream(struct context *, double (* restrict)[64], size_t, const uint8_t [restrict static 64],
-                                                                         size_t * restrict);
-internal struct JPEG_encoded_value * generate_JPEG_chrominance_data_stream(struct context *, double (* restrict)[64], double (* restrict)[64], size_t,
+internal struct JPEG_encoded_value * generate_JPEG_luminance_data_stream(struct context *, double (* restrict)[64], size_t, size_t,
+                                                                         const uint8_t [restrict static 64], size_t * restrict);
+internal struct JPEG_encoded_value * generate_JPEG_chrominance_data_stream(struct context *, double (* restrict)[64], double (* restrict)[64], size_t, size_t,
                                                                            const uint8_t [restrict static 64], size_t * restrict);
-internal double generate_JPEG_data_unit(struct JPEG_encoded_value *, size_t * restrict, const double [restrict static 64], const uint8_t [restrict static 64],
+internal struct JPEG_encoded_value * generate_JPEG_coefficient_data_stream(struct context *, int16_t (* restrict)[64], size_t, size_t, size_t,
+                                                                          size_t * restrict);
+internal double generate_JPEG_data_unit(struct JPEG_encoded_value *, size_t * restrict, const double [restrict static 64], const double [restrict static 64],
                                         double);
+internal void encode_JPEG_coefficients(struct JPEG_encoded_value *, size_t * restrict, const int16_t [restrict static 64]);
 internal void encode_JPEG_value(struct JPEG_encoded_value *, int16_t, unsigned, unsigned char);
 internal size_t generate_JPEG_Huffman_table(struct context *, const struct JPEG_encoded_value *, size_t, unsigned char * restrict,
                                             unsigned char [restrict static 0x100], unsigned char);
-internal void encode_JPEG_scan(struct context *, const struct JPEG_encoded_value *, size_t, const unsigned char [restrict static 0x200]);
+internal void encode_JPEG_scan(struct context *, const struct JPEG_encoded_value *, size_t, const unsigned char [restrict static 0x200], size_t);
 
 // jpegdct.c
-internal double apply_JPEG_DCT(int16_t [restrict static 64], const double [restrict static 64], const uint8_t [restrict static 64], double);
-internal void apply_JPEG_inverse_DCT(double [restrict static 64], const int16_t [restrict static 64], const uint16_t [restrict static 64]);
+internal void calculate_JPEG_DCT_scales(double [restrict static 64], const uint8_t [restrict static 64]);
+internal double apply_JPEG_DCT(int16_t [restrict static 64], const double [restrict static 64], const double [restrict static 64], double);
+internal void apply_JPEG_DCT_line(double * restrict, const double * restrict, uint_fast8_t);
+internal void apply_JPEG_inverse_DCT(double [restrict static 64], const int16_t [restrict static 64], const uint16_t [restrict static 64], uint_fast8_t);
+internal void apply_JPEG_inverse_DCT_line(double * restrict, const double * restrict, uint_fast8_t, uint_fast8_t);
+internal void apply_JPEG_reduced_inverse_DCT(double [restrict static 16], const int16_t [restrict static 64], const uint16_t [restrict static 64],
+                                             uint_fast8_t, uint_fast8_t);
+internal void apply_JPEG_reduced_inverse_DCT_line(double * restrict, const double * restrict, uint_fast8_t, uint_fast8_t);
 
 // jpegdecompress.c
 internal void initialize_JPEG_decompressor_state(struct context *, struct JPEG_decompressor_state * restrict, const struct JPEG_component_info *,
@@ -193,39 +220,74 @@ internal void decompress_JPEG_Huffman_bit_scan(struct context *, struct JPEG_dec
                                                const struct JPEG_component_info *, const size_t * restrict, unsigned, unsigned char, unsigned char);
 internal void decompress_JPEG_Huffman_lossless_scan(struct context *, struct JPEG_decompressor_state * restrict, const struct JPEG_decoder_tables *, size_t,
                                                     const struct JPEG_component_info *, const size_t * restrict, unsigned char, unsigned);
+internal void generate_JPEG_Huffman_lookup_tables(const struct JPEG_decoder_tables *, short [restrict static 8][0x100]);
 internal unsigned char next_JPEG_Huffman_value(struct context *, const unsigned char **, size_t * restrict, uint32_t * restrict, uint8_t * restrict,
-                                               const short * restrict);
+                                               const short * restrict, const short * restrict);
 
 // jpegread.c
 internal void load_JPEG_data(struct context *, unsigned, size_t);
-internal struct JPEG_marker_layout * load_JPEG_marker_layout(struct context *);
+internal struct JPEG_marker_layout * load_JPEG_marker_layout(struct context *, bool);
+internal uint16_t get_JPEG_frame_height(struct context *, const struct JPEG_marker_layout *);
 internal unsigned get_JPEG_rotation(struct context *, size_t);
-internal unsigned load_single_frame_JPEG(struct context *, const struct JPEG_marker_layout *, uint32_t, double **);
+internal size_t find_JPEG_Exif_marker(struct context *);
+internal size_t get_JPEG_thumbnail(struct context *, size_t, size_t * restrict);
+internal unsigned load_single_frame_JPEG(struct context *, const struct JPEG_marker_layout *, uint32_t, size_t, size_t, unsigned,
+                                         void (*) (uint64_t * restrict, size_t, unsigned, const float **), unsigned, unsigned);
+internal void write_JPEG_component_data(struct context *, void (*) (uint64_t * restrict, size_t, unsigned, const float **), const float **, size_t, size_t,
+                                        unsigned, unsigned, unsigned, uint64_t * restrict);
+internal void write_JPEG_pixels(struct context *, const uint64_t * restrict, size_t, size_t, unsigned, unsigned);
+internal void write_JPEG_component_planes(struct context *, void (*) (uint64_t * restrict, size_t, unsigned, const float **), const double **, size_t, unsigned,
+                                          unsigned, unsigned);
 internal unsigned char process_JPEG_metadata_until_offset(struct context *, const struct JPEG_marker_layout *, struct JPEG_decoder_tables *, size_t * restrict,
                                                           size_t);
 
 // jpegreadframe.c
 internal void load_JPEG_DCT_frame(struct context *, const struct JPEG_marker_layout *, uint32_t, size_t, struct JPEG_decoder_tables *, size_t * restrict,
                                   double **, unsigned, size_t, size_t);
+internal void load_JPEG_DCT_frame_to_image(struct context *, const struct JPEG_marker_layout *, uint32_t, struct JPEG_decoder_tables *, size_t * restrict,
+                                           unsigned, size_t, size_t, unsigned, void (*) (uint64_t * restrict, size_t, unsigned, const float **), unsigned,
+                                           unsigned);
+internal void decode_JPEG_DCT_frame(struct context *, const struct JPEG_marker_layout *, uint32_t, size_t, struct JPEG_decoder_tables *, size_t * restrict,
+                                    unsigned, size_t, size_t, bool, struct JPEG_DCT_frame * restrict);
+internal void transform_JPEG_MCU_row(float * restrict, size_t, const struct JPEG_DCT_frame *, uint_fast8_t, size_t, const uint16_t * restrict, unsigned);
+internal void transform_JPEG_block_float(float * restrict, size_t, const int16_t [restrict static 64], const uint16_t [restrict static 64], unsigned);
+internal void transform_JPEG_block_double(double * restrict, size_t, const int16_t [restrict static 64], const uint16_t [restrict static 64], unsigned);
 internal void load_JPEG_lossless_frame(struct context *, const struct JPEG_marker_layout *, uint32_t, size_t, struct JPEG_decoder_tables *, size_t * restrict,
                                        double **, unsigned, size_t, size_t);
 internal unsigned get_JPEG_component_info(struct context *, const unsigned char *, struct JPEG_component_info * restrict, uint32_t);
 internal const unsigned char * get_JPEG_scan_components(struct context *, size_t, struct JPEG_component_info * restrict, unsigned, unsigned char * restrict);
 internal void unpack_JPEG_component(double * restrict, double * restrict, size_t, size_t, size_t, size_t, unsigned char, unsigned char, unsigned char,
                                     unsigned char);
+internal void interpolate_JPEG_component_float(float * restrict, const float * restrict, size_t, size_t, size_t, unsigned char, unsigned char,
+                                               unsigned char, unsigned char);
+internal void interpolate_JPEG_component_double(double * restrict, const double * restrict, size_t, size_t, size_t, unsigned char, unsigned char,
+                                                unsigned char, unsigned char);
 
 // jpegtables.c
 internal void initialize_JPEG_decoder_tables(struct context *, struct JPEG_decoder_tables *, const struct JPEG_marker_layout *);
 internal short * process_JPEG_Huffman_table(struct context *, const unsigned char ** restrict, uint16_t * restrict);
 internal void load_default_JPEG_Huffman_tables(struct context *, struct JPEG_decoder_tables * restrict);
 
+// jpegtransform.c
+internal void transform_JPEG_data(struct context *, unsigned, bool, const struct plum_rectangle * restrict);
+internal void requantize_JPEG_data(struct context *, unsigned);
+internal void requantize_JPEG_component(const struct JPEG_DCT_frame *, uint_fast8_t, const unsigned short * restrict, const unsigned short * restrict, size_t,
+                                        size_t);
+internal unsigned load_JPEG_coefficients(struct context *, struct JPEG_DCT_frame * restrict, struct JPEG_decoder_tables * restrict, size_t * restrict,
+                                         size_t * restrict);
+internal void generate_transcoded_JPEG_data(struct context *, const struct JPEG_DCT_frame *, unsigned short * const *, size_t, size_t, unsigned);
+internal void copy_JPEG_metadata_markers(struct context *, const unsigned char *, size_t);
+internal void generate_JPEG_coefficient_data(struct context *, const struct JPEG_DCT_frame *, unsigned short * const *, size_t, size_t, unsigned);
+
 // jpegwrite.c
 internal void generate_JPEG_data(struct context *);
+internal bool JPEG_image_is_grayscale(const struct plum_image *);
 internal void calculate_JPEG_quantization_tables(struct context *, uint8_t [restrict static 64], uint8_t [restrict static 64]);
+internal void calculate_JPEG_quality_table(uint8_t [restrict static 64], const uint8_t [restrict static 64], unsigned);
 internal void convert_JPEG_components_to_YCbCr(struct context *, double (* restrict)[64], double (* restrict)[64], double (* restrict)[64]);
 internal void convert_JPEG_colors_to_YCbCr(const void * restrict, size_t, unsigned char, double * restrict, double * restrict, double * restrict,
                                            uint64_t * restrict);
-internal void subsample_JPEG_component(double (* restrict)[64], double (* restrict)[64], size_t, size_t);
+internal void subsample_JPEG_component(double (* restrict)[64], double (* restrict)[64], size_t, size_t, unsigned char, unsigned char);
 
 // load.c
 internal void load_image_buffer_data(struct context *, unsigned, size_t);
@@ -256,7 +318,7 @@ internal unsigned check_image_palette(const struct plum_image *);
 internal uint64_t get_color_sorting_score(uint64_t, unsigned);
 
 // pngcompress.c
-internal unsigned char * compress_PNG_data(struct context *, const unsigned char * restrict, size_t, size_t, size_t * restrict);
+internal void compress_PNG_data(struct context *, const unsigned char * restrict, size_t, struct PNG_chunk_output * restrict);
 internal struct compressed_PNG_code * generate_compressed_PNG_block(struct context *, const unsigned char * restrict, size_t, size_t, uint16_t * restrict,
                                                                     size_t * restrict, size_t * restrict, bool);
 internal size_t compute_uncompressed_PNG_block_size(const unsigned char * restrict, size_t, size_t, uint16_t * restrict);
@@ -264,11 +326,16 @@ internal unsigned find_PNG_reference(const unsigned char * restrict, const uint1
 internal void append_PNG_reference(const unsigned char * restrict, size_t, uint16_t * restrict);
 internal uint16_t compute_PNG_reference_key(const unsigned char * data);
 internal void emit_PNG_code(struct context *, struct compressed_PNG_code **, size_t * restrict, size_t * restrict, int, unsigned);
+internal size_t select_PNG_block_split(struct context *, const struct compressed_PNG_code * restrict, size_t, bool * restrict);
+internal size_t compute_PNG_block_cost(struct context *, const size_t [restrict static 0x120], const size_t [restrict static 0x20], bool * restrict);
+internal void count_PNG_codes(const struct compressed_PNG_code * restrict, size_t, size_t [restrict static 0x120], size_t [restrict static 0x20]);
 internal unsigned char * emit_PNG_compressed_block(struct context *, const struct compressed_PNG_code * restrict, size_t, bool, size_t * restrict,
                                                    uint32_t * restrict, uint8_t * restrict);
 internal unsigned char * generate_PNG_Huffman_trees(struct context *, uint32_t * restrict, uint8_t * restrict, size_t * restrict,
                                                     const size_t [restrict static 0x120], const size_t [restrict static 0x20],
                                                     unsigned char [restrict static 0x120], unsigned char [restrict static 0x20]);
+internal unsigned encode_PNG_tree_lengths(const unsigned char [restrict static 0x120], const unsigned char [restrict static 0x20],
+                                          unsigned char [restrict static 0x140], unsigned * restrict, unsigned * restrict);
 
 // pngdecompress.c
 internal void * decompress_PNG_data(struct context *, const unsigned char *, size_t, size_t);
@@ -291,6 +358,8 @@ internal uint64_t add_PNG_background_metadata(struct context *, const struct PNG
 internal uint64_t load_PNG_transparent_color(struct context *, size_t, uint8_t, uint8_t);
 internal bool check_PNG_reduced_frames(struct context *, const struct PNG_chunk_locations *);
 internal bool load_PNG_animation_frame_metadata(struct context *, size_t, uint64_t * restrict, uint8_t * restrict);
+internal void add_PNG_retained_data_metadata(struct context *, const struct PNG_chunk_locations *);
+internal size_t get_PNG_frame_data_size(struct context *, const size_t *, size_t);
 
 // pngreadframe.c
 internal void load_PNG_frame(struct context *, const size_t *, uint32_t, const uint64_t *, uint8_t, uint8_t, uint8_t, bool, uint64_t, uint64_t);
@@ -307,11 +376,19 @@ internal void generate_PNG_data(struct context *);
 internal void generate_APNG_data(struct context *);
 internal unsigned generate_PNG_header(struct context *, struct plum_rectangle * restrict);
 internal void append_PNG_header_chunks(struct context *, unsigned, uint32_t);
+internal uint_fast8_t check_PNG_color_reductions(struct context *, bool);
+internal uint_fast8_t check_PNG_color_reductions_for_pixels(const uint64_t * restrict, size_t, uint64_t);
+internal void generate_PNG_reduced_palette(struct context *, unsigned, bool);
 internal void append_PNG_palette_data(struct context *, bool);
 internal void append_PNG_background_chunk(struct context *, const void * restrict, unsigned);
 internal void append_PNG_image_data(struct context *, const void * restrict, unsigned, uint32_t * restrict, const struct plum_rectangle *);
 internal void append_APNG_frame_header(struct context *, uint64_t, uint8_t, uint8_t, uint32_t * restrict, int64_t * restrict, const struct plum_rectangle *);
 internal void output_PNG_chunk(struct context *, uint32_t, uint32_t, const void * restrict);
+internal void append_PNG_chunk_output(struct context *, struct PNG_chunk_output * restrict, const unsigned char * restrict, size_t);
+internal void finish_PNG_chunk_output(struct context *, struct PNG_chunk_output * restrict);
+internal const struct PNG_retained_data * get_PNG_retained_data(struct context *);
+internal void append_PNG_retained_header(struct context *, const struct PNG_retained_data *);
+internal void append_PNG_retained_background_chunk(struct context *, const struct PNG_retained_data *, const void * restrict);
 internal unsigned char * generate_PNG_frame_data(struct context *, const void * restrict, unsigned, size_t * restrict, const struct plum_rectangle *);
 internal void generate_PNG_row_data(struct context *, const void * restrict, unsigned char * restrict, size_t, unsigned);
 internal void filter_PNG_rows(unsigned char * restrict, const unsigned char * restrict, size_t, unsigned);
@@ -349,6 +426,7 @@ internal void quicksort_pairs(struct pair * restrict, uint64_t);
 internal void merge_sorted_pairs(struct pair * restrict, uint64_t, struct pair * restrict);
 
 // store.c
+internal size_t write_generated_image_output(struct context *, void * restrict, size_t);
 internal void write_generated_image_data_to_file(struct context *, const char *);
 internal void write_generated_image_data_to_callback(struct context *, const struct plum_callback *);
 internal void write_generated_image_data(void * restrict, const struct data_node *);
@@ -21,27 +21,7 @@ size_t plum_store_image (const struct plum_image * image, void * restrict buffer
       case PLUM_IMAGE_PNM: generate_PNM_data(context); break;
       default: throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
     }
-    size_t output_size = get_total_output_size(context);
-    if (!output_size) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
-    switch (size_mode) {
-      case PLUM_MODE_FILENAME:
-        write_generated_image_data_to_file(context, buffer);
-        break;
-      case PLUM_MODE_BUFFER: {
-        void * out = malloc(output_size);
-        if (!out) throw(context, PLUM_ERR_OUT_OF_MEMORY);
-        // the function must succeed after reaching this point (otherwise, memory would be leaked)
-        *(struct plum_buffer *) buffer = (struct plum_buffer) {.size = output_size, .data = out};
-        write_generated_image_data(out, context -> output);
-      } break;
-      case PLUM_MODE_CALLBACK:
-        write_generated_image_data_to_callback(context, buffer);
-        break;
-      default:
-        if (output_size > size_mode) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
-        write_generated_image_data(buffer, context -> output);
-    }
-    context -> size = output_size;
+    context -> size = write_generated_image_output(context, buffer, size_mode);
   }
   if (context -> file) fclose(context -> file);
   if (error) *error = context -> status;
@@ -50,6 +30,31 @@ size_t plum_store_image (const struct plum_image * image, void * restrict buffer
   return result;
 }
 
+size_t write_generated_image_output (struct context * context, void * restrict buffer, size_t size_mode) {
+  // writes out the generated data to its destination, as chosen by size_mode; returns the total size written
+  size_t output_size = get_total_output_size(context);
+  if (!output_size) throw(context, PLUM_ERR_INVALID_FILE_FORMAT);
+  switch (size_mode) {
+    case PLUM_MODE_FILENAME:
+      write_generated_image_data_to_file(context, buffer);
+      break;
+    case PLUM_MODE_BUFFER: {
+      void * out = malloc(output_size);
+      if (!out) throw(context, PLUM_ERR_OUT_OF_MEMORY);
+      // the function must succeed after reaching this point (otherwise, memory would be leaked)
+      *(struct plum_buffer *) buffer = (struct plum_buffer) {.size = output_size, .data = out};
+      write_generated_image_data(out, context -> output);
+    } break;
+    case PLUM_MODE_CALLBACK:
+      write_generated_image_data_to_callback(context, buffer);
+      break;
+    default:
+      if (output_size > size_mode) throw(context, PLUM_ERR_IMAGE_TOO_LARGE);
+      write_generated_image_data(buffer, context -> output);
+  }
+  return output_size;
+}
+
 void write_generated_image_data_to_file (struct context * context, const char * filename) {
   context -> file = fopen(filename, "wb");
   if (!context -> file) throw(context, PLUM_ERR_FILE_INACCESSIBLE);
@@ -64,6 +64,26 @@ struct PNG_chunk_locations {
   size_t ** framedata; // fdAT
 };
 
+struct PNG_retained_data {
+  // contents of a PLUM_METADATA_PNG_DATA node; followed by the PLTE and tRNS chunk data and then the compressed data for each frame
+  uint64_t hash;
+  uint32_t frames;
+  uint16_t palette_size;
+  uint16_t transparency_size;
+  uint8_t bitdepth;
+  uint8_t imagetype;
+  uint8_t interlaced;
+  size_t sizes[]; // compressed size of each frame
+};
+
+struct PNG_chunk_output {
+  // IDAT or fdAT chunk (if chunkID is not null) currently being filled in; chunk is null if there is no chunk in progress
+  unsigned char * chunk;
+  uint32_t * chunkID;
+  size_t size; // bytes written to the chunk's data so far (including the sequence number for fdAT chunks)
+  uint32_t crc;
+};
+
 struct compressed_PNG_code {
   unsigned datacode:   9;
   unsigned dataextra:  5;
@@ -100,6 +120,16 @@ struct JPEG_component_info {
   unsigned scaleV:  4;
 };
 
+struct JPEG_DCT_frame {
+  int16_t (* restrict component_data[4])[64];
+  struct JPEG_component_info component_info[4];
+  size_t unitrow;
+  size_t unitcol;
+  unsigned char count;
+  unsigned char maxH;
+  unsigned char maxV;
+};
+
 struct JPEG_decompressor_state {
   union {
     int16_t (* restrict current_block[4])[64];